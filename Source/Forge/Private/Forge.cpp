@@ -9,8 +9,49 @@
 #include "PlatformHttp.h"
 #include "Interfaces/IHttpRequest.h"
 #include "Interfaces/IHttpResponse.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/SecureHash.h"
 #include "Interfaces/IPluginManager.h"
 #include "Compression/OodleDataCompressionUtil.h"
+#include "Async/Async.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#if PLATFORM_LINUX
+#include <dirent.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef POSIX_SPAWN_USEVFORK
+#define POSIX_SPAWN_USEVFORK 0x40
+#endif
+
+extern char** environ;
+#endif
+
+#if PLATFORM_MAC
+#include <crt_externs.h>
+#endif
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <sys/resource.h>
+#endif
+
+#if PLATFORM_WINDOWS
+#include "Windows/WindowsHWrapper.h"
+#endif
 
 #undef FFileHelper
 #undef IFileManager
@@ -296,9 +337,16 @@ FString GetRootDirectory()
 ///////////////////////////////////////////////////////////////////////////////
 
 FString GForgeWorkingDirectory;
+// Set by FScopedWorkingDirectory, takes precedence over GForgeWorkingDirectory on this thread
+thread_local FString* GForgeThreadWorkingDirectory = nullptr;
 
 FString GetWorkingDirectory()
 {
+	if (GForgeThreadWorkingDirectory)
+	{
+		return *GForgeThreadWorkingDirectory;
+	}
+
 	return GForgeWorkingDirectory;
 }
 
@@ -313,629 +361,5933 @@ void SetWorkingDirectory(const FString& NewWorkingDirectory)
 		LOG_FATAL("SetWorkingDirectory: %s does not exist", *AbsoluteWorkingDirectory);
 	}
 
+	if (GForgeThreadWorkingDirectory)
+	{
+		*GForgeThreadWorkingDirectory = NewWorkingDirectory;
+		return;
+	}
+
 	GForgeWorkingDirectory = NewWorkingDirectory;
 }
 
-bool ExecImpl(
-	const FString& CommandLine,
-	const bool bAllowFailure,
-	FString& Output,
-	const TSet<int32>& ValidExitCodes)
+FScopedWorkingDirectory::FScopedWorkingDirectory(const FString& WorkingDirectory)
+	: WorkingDirectory(WorkingDirectory)
+	, PreviousWorkingDirectory(GForgeThreadWorkingDirectory)
 {
-	check(!GForgeWorkingDirectory.IsEmpty());
-	check(FPaths::DirectoryExists(GForgeWorkingDirectory));
+	if (!FPaths::DirectoryExists(FPaths::ConvertRelativePathToFull(WorkingDirectory)))
+	{
+		LOG_FATAL("FScopedWorkingDirectory: %s does not exist", *WorkingDirectory);
+	}
 
-	LOG("%s", *CommandLine);
+	GForgeThreadWorkingDirectory = &this->WorkingDirectory;
+}
 
-	void* PipeRead = nullptr;
-	void* PipeWrite = nullptr;
-	check(FPlatformProcess::CreatePipe(PipeRead, PipeWrite));
+FScopedWorkingDirectory::~FScopedWorkingDirectory()
+{
+	check(GForgeThreadWorkingDirectory == &WorkingDirectory);
+	GForgeThreadWorkingDirectory = PreviousWorkingDirectory;
+}
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+char** GetEnvironment()
+{
+#if PLATFORM_MAC
+	return *_NSGetEnviron();
+#else
+	return environ;
+#endif
+}
+
+// The editor address space is huge: make sure spawning never copies its page tables
+// glibc >= 2.24 always spawns with CLONE_VM | CLONE_VFORK, older versions fork unless asked not to.
+// On Mac posix_spawn is a syscall and never forks.
+short GetSpawnFlags()
+{
+	short Flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#if PLATFORM_LINUX
+	Flags |= POSIX_SPAWN_USEVFORK;
+#endif
+	return Flags;
+}
+
+struct FSpawnSignals
+{
+	sigset_t Mask;
+	sigset_t Default;
+};
+
+// Children should not inherit our blocked signals nor our ignored SIGPIPE
+const FSpawnSignals& GetSpawnSignals()
+{
+	static const FSpawnSignals Signals = []
+	{
+		FSpawnSignals Result;
+		sigemptyset(&Result.Mask);
+		sigemptyset(&Result.Default);
+		sigaddset(&Result.Default, SIGPIPE);
+		return Result;
+	}();
+	return Signals;
+}
 
-	FProcHandle ProcHandle = INLINE_LAMBDA
+#if PLATFORM_LINUX
+// /proc files report a size of 0, so they need to be read until EOF
+FString ReadProcFile(const FString& Path)
+{
+	const int32 Fd = open(TCHAR_TO_UTF8(*Path), O_RDONLY | O_CLOEXEC);
+	if (Fd == -1)
 	{
-		if (IsWindows())
+		return {};
+	}
+	ON_SCOPE_EXIT
+	{
+		close(Fd);
+	};
+
+	TArray<uint8> Data;
+	while (true)
+	{
+		uint8 Buffer[4096];
+		const ssize_t Count = read(Fd, Buffer, sizeof(Buffer));
+		if (Count == -1 &&
+			errno == EINTR)
 		{
-			return FPlatformProcess::CreateProc(
-				TEXT("cmd.exe"),
-				*("/c \"" + CommandLine + "\""),
-				false,
-				false,
-				false,
-				nullptr,
-				0,
-				*GForgeWorkingDirectory,
-				PipeWrite,
-				nullptr,
-				PipeWrite);
+			continue;
 		}
-		else
+		if (Count <= 0)
 		{
-			const FString Path = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) / "Script.sh";
+			break;
+		}
+		Data.Append(Buffer, int32(Count));
+	}
 
-			check(FFileHelper::SaveStringToFile(CommandLine, *Path));
+	const FUTF8ToTCHAR Converter(reinterpret_cast<const ANSICHAR*>(Data.GetData()), Data.Num());
+	return FString(Converter.Length(), Converter.Get());
+}
 
-			return FPlatformProcess::CreateProc(
-				TEXT("/bin/bash"),
-				*Path,
-				false,
-				false,
-				false,
-				nullptr,
-				0,
-				*GForgeWorkingDirectory,
-				PipeWrite,
-				nullptr,
-				PipeWrite);
-		}
-	};
-	check(ProcHandle.IsValid());
+// Samples the process tree of a command that has gone silent, to tell apart a busy child from a stuck one
+class FProcessTreeSampler
+{
+public:
+	FProcessTreeSampler(
+		const pid_t RootProcessId,
+		const double StartTime)
+		: RootProcessId(RootProcessId)
+		, LastSampleTime(StartTime)
+	{
+	}
 
-	const auto FlushReadPipe = [&]
+	void LogSample(const FString& LogPrefix)
 	{
-		bool bHasReadAnything = false;
-		while (true)
+		struct FProcess
 		{
-			const FString Text = FPlatformProcess::ReadPipe(PipeRead);
-			if (Text.IsEmpty())
-			{
-				return bHasReadAnything;
-			}
-			bHasReadAnything = true;
+			int32 ProcessId = 0;
+			int32 ParentProcessId = 0;
+			FString Name;
+			FString State;
+			double CpuTime = 0;
+			int64 Memory = 0;
+		};
 
-			Output += Text;
+		static const double TicksPerSecond = sysconf(_SC_CLK_TCK);
+		static const int64 PageSize = sysconf(_SC_PAGESIZE);
 
-			TArray<FString> Lines;
-			Text.ParseIntoArrayLines(Lines);
+		TMap<int32, FProcess> Processes;
+		TMultiMap<int32, int32> ParentToChildren;
 
-			for (FString& Line : Lines)
+		if (DIR* Directory = opendir("/proc"))
+		{
+			while (const dirent* Entry = readdir(Directory))
 			{
-				Line.TrimStartAndEndInline();
+				const int32 ProcessId = FCStringAnsi::Atoi(Entry->d_name);
+				if (ProcessId <= 0)
+				{
+					continue;
+				}
 
-				if (Line.IsEmpty())
+				// pid (comm) state ppid ... utime stime ... rss, comm can contain spaces
+				const FString Stat = ReadProcFile(FString::Printf(TEXT("/proc/%d/stat"), ProcessId));
+				const int32 NameStart = Stat.Find(TEXT("("));
+				const int32 NameEnd = Stat.Find(TEXT(")"), ESearchCase::CaseSensitive, ESearchDir::FromEnd);
+				if (NameStart == -1 ||
+					NameEnd == -1)
 				{
 					continue;
 				}
 
-				if (Line.StartsWith("Warning: Permanently added 'github.com'") ||
-					Line.StartsWith("Your branch is up to date") ||
-					Line.StartsWith("Already on") ||
-					Line.StartsWith("Already up to date."))
+				TArray<FString> Fields;
+				Stat.RightChop(NameEnd + 2).ParseIntoArrayWS(Fields);
+				if (Fields.Num() < 22)
 				{
 					continue;
 				}
 
-				LOG("\t%s", *Line);
+				FProcess Process;
+				Process.ProcessId = ProcessId;
+				Process.ParentProcessId = FCString::Atoi(*Fields[1]);
+				Process.Name = Stat.Mid(NameStart + 1, NameEnd - NameStart - 1);
+				Process.State = Fields[0];
+				Process.CpuTime = (FCString::Atoi64(*Fields[11]) + FCString::Atoi64(*Fields[12])) / TicksPerSecond;
+				Process.Memory = FCString::Atoi64(*Fields[21]) * PageSize;
+
+				ParentToChildren.Add(Process.ParentProcessId, ProcessId);
+				Processes.Add(ProcessId, MoveTemp(Process));
 			}
+			closedir(Directory);
 		}
-	};
-
-	double LastReadTime = FPlatformTime::Seconds();
-	while (FPlatformProcess::IsProcRunning(ProcHandle))
-	{
-		FPlatformProcess::Sleep(0.01f);
 
-		if (FlushReadPipe())
+		TArray<int32> Tree;
+		if (Processes.Contains(RootProcessId))
 		{
-			LastReadTime = FPlatformTime::Seconds();
+			Tree.Add(RootProcessId);
 		}
-
-		if (FPlatformTime::Seconds() - LastReadTime > 30)
+		for (int32 Index = 0; Index < Tree.Num(); Index++)
 		{
-			LastReadTime = FPlatformTime::Seconds();
-
-			LOG("[Waiting for command]");
+			const int32 ParentProcessId = Tree[Index];
+			ParentToChildren.MultiFind(ParentProcessId, Tree);
 		}
-	}
-
-	int32 ReturnCode = 1;
-	check(FPlatformProcess::GetProcReturnCode(ProcHandle, &ReturnCode));
 
-	FlushReadPipe();
+		const double Time = FPlatformTime::Seconds();
+		const double Elapsed = FMath::Max(Time - LastSampleTime, 0.001);
+		LastSampleTime = Time;
 
-	FPlatformProcess::ClosePipe(PipeRead, PipeWrite);
+		LOG("%s[Waiting for command] %d processes alive", *LogPrefix, Tree.Num());
+		LOG("%s\t%8s %6s %9s %9s %9s %5s %-24s %s", *LogPrefix, TEXT("PID"), TEXT("CPU"), TEXT("MEMORY"), TEXT("READ"), TEXT("WRITTEN"), TEXT("STATE"), TEXT("WAITING IN"), TEXT("NAME"));
 
-	if (!ValidExitCodes.Contains(ReturnCode))
-	{
-		if (bAllowFailure)
+		TMap<int32, double> NewCpuTimes;
+		for (const int32 ProcessId : Tree)
 		{
-			return false;
-		}
+			const FProcess& Process = Processes[ProcessId];
+			NewCpuTimes.Add(ProcessId, Process.CpuTime);
 
-		LOG_FATAL("%s returned %d\nWorking directory: %s", *CommandLine, ReturnCode, *GForgeWorkingDirectory);
-	}
+			const double CpuUsage = (Process.CpuTime - LastCpuTimes.FindRef(ProcessId)) / Elapsed;
 
-	Output.RemoveFromEnd("\n");
-	return true;
-}
+			int64 BytesRead = 0;
+			int64 BytesWritten = 0;
+			{
+				TArray<FString> Lines;
+				ReadProcFile(FString::Printf(TEXT("/proc/%d/io"), ProcessId)).ParseIntoArrayLines(Lines);
 
-FString Exec(
-	const FString& CommandLine,
-	const TSet<int32>& ValidExitCodes)
-{
-	FString Output;
-	check(ExecImpl(
-		CommandLine,
-		false,
-		Output,
-		ValidExitCodes));
-	return Output;
-}
+				for (const FString& Line : Lines)
+				{
+					FString Key;
+					FString Value;
+					if (!Line.Split(":", &Key, &Value))
+					{
+						continue;
+					}
 
-FString Exec_PostErrors(
-	const FString& CommandLine,
-	const TSet<int32>& ValidExitCodes)
-{
-	LOG("##teamcity[compilationStarted compiler='Execute']");
+					if (Key == "rchar")
+					{
+						BytesRead = FCString::Atoi64(*Value.TrimStart());
+					}
+					else if (Key == "wchar")
+					{
+						BytesWritten = FCString::Atoi64(*Value.TrimStart());
+					}
+				}
+			}
 
-	FString Output;
-	const bool bSuccess = ExecImpl(CommandLine, true, Output, ValidExitCodes);
+			// Kernel function the process is sleeping in, or the syscall it is blocked on
+			FString WaitingIn = ReadProcFile(FString::Printf(TEXT("/proc/%d/wchan"), ProcessId)).TrimStartAndEnd();
+			if (WaitingIn.IsEmpty() ||
+				WaitingIn == "0")
+			{
+				const FString Syscall = ReadProcFile(FString::Printf(TEXT("/proc/%d/syscall"), ProcessId));
+				WaitingIn = Syscall.StartsWith("running") ? "running" : "syscall " + Syscall.Left(Syscall.Find(TEXT(" ")));
+			}
 
-	LOG("##teamcity[compilationFinished compiler='Execute']");
+			LOG("%s\t%8d %5.0f%% %9s %9s %9s %5s %-24s %s",
+				*LogPrefix,
+				ProcessId,
+				CpuUsage * 100,
+				*BytesToString(Process.Memory),
+				*BytesToString(BytesRead),
+				*BytesToString(BytesWritten),
+				*Process.State,
+				*WaitingIn.Left(24),
+				*Process.Name);
+		}
 
-	if (bSuccess)
-	{
-		return Output;
+		LastCpuTimes = MoveTemp(NewCpuTimes);
 	}
 
-	TArray<FString> Lines;
-	Output.ParseIntoArrayLines(Lines);
+private:
+	const pid_t RootProcessId;
+	double LastSampleTime;
+	TMap<int32, double> LastCpuTimes;
+};
+#endif
+
+// Split a command line into arguments if it can be run without a shell
+// Returns false if the command uses anything bash would expand or interpret
+bool ParseCommandLineArguments(
+	const FString& CommandLine,
+	TArray<FString>& OutArguments)
+{
+	FString Argument;
+	bool bHasArgument = false;
+	TCHAR Quote = 0;
 
-	Lines.RemoveAll([](const FString& Line)
+	for (const TCHAR Char : CommandLine)
 	{
-		if (Line.Contains("0 Warning(s)") ||
-			Line.Contains("0 Error(s)") ||
-			Line.Contains("Failed to create pipeline state with combined hash") ||
-			Line.Contains("Failed to create compute PSO with combined hash") ||
-			Line.Contains("Failed to create compute pipeline with hash") ||
-			Line.Contains("no platform load command found") ||
-			Line.Contains("LogRHI: Error: Shader:"))
+		if (Quote == TEXT('\''))
 		{
-			return true;
+			if (Char == TEXT('\''))
+			{
+				Quote = 0;
+				continue;
+			}
+
+			Argument += Char;
+			continue;
 		}
 
-		return
-			!Line.Contains("error") &&
-			!Line.Contains("warning") &&
-			!Line.StartsWith("D:\\Perforce\\");
-	});
+		if (Quote == TEXT('"'))
+		{
+			if (Char == TEXT('"'))
+			{
+				Quote = 0;
+				continue;
+			}
 
-	for (const FString& Line : Lines)
-	{
-		LOG("##teamcity[message text='%s' status='ERROR']", *EscapeTeamCity(Line));
-	}
+			if (Char == TEXT('$') ||
+				Char == TEXT('`') ||
+				Char == TEXT('\\'))
+			{
+				return false;
+			}
 
-	Lines.SetNum(FMath::Min(Lines.Num(), 10));
+			Argument += Char;
+			continue;
+		}
 
-	FString Message = "```\n";
-	for (const FString& Line : Lines)
-	{
-		Message += Line + "\n";
-	}
-	Message += "```";
+		if (Char == TEXT('\'') ||
+			Char == TEXT('"'))
+		{
+			Quote = Char;
+			bHasArgument = true;
+			continue;
+		}
 
-	PostFatalSlackMessage(Message);
-	return {};
-}
+		if (Char == TEXT(' ') ||
+			Char == TEXT('\t'))
+		{
+			if (bHasArgument)
+			{
+				OutArguments.Add(MoveTemp(Argument));
+				Argument.Reset();
+				bHasArgument = false;
+			}
+			continue;
+		}
 
-bool TryExec(
-	const FString& CommandLine,
-	const TSet<int32>& ValidExitCodes)
-{
-	FString Output;
-	return ExecImpl(
-		CommandLine,
-		true,
-		Output,
-		ValidExitCodes);
-}
+		if (FCString::Strchr(TEXT("|&;<>()$`\\*?[]{}\r\n"), Char))
+		{
+			return false;
+		}
 
-bool TryExec(
-	const FString& CommandLine,
-	FString& Output,
-	const TSet<int32>& ValidExitCodes)
-{
-	return ExecImpl(
-		CommandLine,
-		true,
-		Output,
-		ValidExitCodes);
-}
+		if (!bHasArgument &&
+			(Char == TEXT('#') || Char == TEXT('~')))
+		{
+			return false;
+		}
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+		if (OutArguments.Num() == 0 &&
+			Char == TEXT('='))
+		{
+			// Environment variable assignment
+			return false;
+		}
 
-FString Git_GetRevision()
-{
-	return Exec("git rev-parse HEAD");
-}
+		Argument += Char;
+		bHasArgument = true;
+	}
 
-FString Git_GetShortRevision()
-{
-	const FString Revision = Exec("git rev-parse HEAD");
-	const FString ShortRevision = Exec("git rev-parse --short HEAD");
-	check(Revision.StartsWith(ShortRevision));
+	if (Quote != 0)
+	{
+		return false;
+	}
 
-	if (ShortRevision.Len() > 9)
+	if (bHasArgument)
 	{
-		// We have a collision
-		LOG_FATAL("Short revision is too long: %s", *ShortRevision);
+		OutArguments.Add(MoveTemp(Argument));
 	}
 
-	return Revision.Left(9);
+	return OutArguments.Num() > 0;
 }
+#endif
 
-int32 Git_GetChangelist()
+// Splits raw UTF-8 output into lines, reassembling lines that straddle two reads
+// Bytes are only converted to FString once a full line is available
+class FUtf8LineSplitter
 {
-	return StringToInt(Exec("git rev-list --count HEAD"));
-}
+public:
+	template<typename LambdaType>
+	void Append(
+		const TConstArrayView<uint8> Data,
+		LambdaType&& OnLine)
+	{
+		int32 LineStart = 0;
+		for (int32 Index = 0; Index < Data.Num(); Index++)
+		{
+			const uint8 Char = Data[Index];
+			if (Char != '\n' &&
+				Char != '\r')
+			{
+				bLastWasCarriageReturn = false;
+				continue;
+			}
 
-void Git_Fetch()
-{
-	Exec("git reset --hard");
-	Exec("git clean -df");
-	Exec("git fetch");
-	Exec("git fetch --tags --force");
-	TryExec("git pull");
-}
+			// Treat \r\n as a single line break, even if split across reads
+			if (Char == '\n' &&
+				bLastWasCarriageReturn &&
+				Index == LineStart &&
+				PendingLine.Num() == 0)
+			{
+				bLastWasCarriageReturn = false;
+				LineStart = Index + 1;
+				continue;
+			}
+			bLastWasCarriageReturn = Char == '\r';
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+			if (PendingLine.Num() == 0)
+			{
+				OnLine(ToString(Data.Slice(LineStart, Index - LineStart)));
+			}
+			else
+			{
+				PendingLine.Append(Data.Slice(LineStart, Index - LineStart));
+				OnLine(ToString(PendingLine));
+				PendingLine.Reset();
+			}
 
-bool HasCommandLineSwitch(const FString& Name)
-{
-	check(!Name.Contains("-"));
-	check(!Name.Contains("="));
+			LineStart = Index + 1;
+		}
 
-	return FParse::Param(*GForgeArgs, *Name);
-}
+		PendingLine.Append(Data.Slice(LineStart, Data.Num() - LineStart));
+	}
 
-FString GetCommandLineValue(const FString& Name)
-{
-	check(!Name.Contains("-"));
-	check(!Name.Contains("="));
+	template<typename LambdaType>
+	void Flush(LambdaType&& OnLine)
+	{
+		if (PendingLine.Num() > 0)
+		{
+			OnLine(ToString(PendingLine));
+			PendingLine.Reset();
+		}
+	}
 
-	FString Value;
-	if (!FParse::Value(*GForgeArgs, *("-" + Name + "="), Value, false) ||
-		Value.IsEmpty())
+private:
+	TArray<uint8> PendingLine;
+	bool bLastWasCarriageReturn = false;
+
+	static FString ToString(const TConstArrayView<uint8> Line)
 	{
-		LOG_FATAL("Missing commandline argument: %s", *Name);
+		if (Line.Num() == 0)
+		{
+			return {};
+		}
+
+		const FUTF8ToTCHAR Converter(reinterpret_cast<const ANSICHAR*>(Line.GetData()), Line.Num());
+		return FString(Converter.Length(), Converter.Get());
 	}
-	return Value;
-}
+};
 
-bool GetCommandLineBool(const FString& Name)
+// All the filters compiled into a single Aho-Corasick automaton, so every line is classified in one pass
+// Matching is case insensitive, like FString::Contains
+class FExecLineClassifier
 {
-	const FString Value = GetCommandLineValue(Name);
+public:
+	enum class EMatch : uint8
+	{
+		Contains,
+		Prefix
+	};
 
-	if (Value != "false" &&
-		Value != "true")
+	void Add(
+		const EExecLineType Type,
+		const EMatch Match,
+		const FString& Pattern)
 	{
-		LOG_FATAL("Invalid command line value for %s: %s", *Name, *Value);
+		check(!Pattern.IsEmpty());
+		check(NumSymbols == 0);
+
+		FPattern& NewPattern = Patterns.Emplace_GetRef();
+		NewPattern.Type = Type;
+		NewPattern.Match = Match;
+		NewPattern.Text = Pattern.ToLower();
 	}
 
-	return Value == "true";
-}
+	void LoadFile(const FString& Path)
+	{
+		LOG("Loading output filters from %s", *Path);
 
-TArray<FString> GetCommandLineArray(const FString& Name)
-{
-	const FString Value = GetCommandLineValue(Name);
+		TArray<FString> Lines;
+		LoadTextFile(Path).ParseIntoArrayLines(Lines, false);
 
-	TArray<FString> Array;
-	Value.ParseIntoArray(Array, TEXT(","));
-	check(Array.Num() > 0);
+		for (int32 Index = 0; Index < Lines.Num(); Index++)
+		{
+			const FString Line = Lines[Index].TrimStartAndEnd();
+			if (Line.IsEmpty() ||
+				Line.StartsWith("#"))
+			{
+				continue;
+			}
 
-	return Array;
-}
+			// <suppress|ignore|error|warning> <contains|prefix> <text>
+			FString TypeName;
+			FString Rest;
+			FString MatchName;
+			FString Text;
+			if (!Line.Split(" ", &TypeName, &Rest) ||
+				!Rest.TrimStart().Split(" ", &MatchName, &Text) ||
+				Text.IsEmpty())
+			{
+				LOG_FATAL("%s:%d: invalid filter, expected <suppress|ignore|error|warning> <contains|prefix> <text>", *Path, Index + 1);
+			}
 
-TOptional<FString> TryGetCommandLineValue(const FString& Name)
+			const TMap<FString, EExecLineType> NameToType =
+			{
+				{ "suppress", EExecLineType::Suppressed },
+				{ "ignore", EExecLineType::Ignored },
+				{ "error", EExecLineType::Error },
+				{ "warning", EExecLineType::Warning },
+			};
+			const EExecLineType* Type = NameToType.Find(TypeName.ToLower());
+			if (!Type)
+			{
+				LOG_FATAL("%s:%d: invalid filter type %s", *Path, Index + 1, *TypeName);
+			}
+
+			if (MatchName != "contains" &&
+				MatchName != "prefix")
+			{
+				LOG_FATAL("%s:%d: invalid filter match %s", *Path, Index + 1, *MatchName);
+			}
+
+			Add(*Type, MatchName == "prefix" ? EMatch::Prefix : EMatch::Contains, Text);
+		}
+	}
+
+	void Compile()
+	{
+		check(NumSymbols == 0);
+
+		// Symbol 0 is any character not used by any pattern
+		NumSymbols = 1;
+		FMemory::Memzero(AsciiToSymbol);
+
+		for (const FPattern& Pattern : Patterns)
+		{
+			for (const TCHAR Char : Pattern.Text)
+			{
+				if (GetSymbol(Char) == 0)
+				{
+					if (Char < 128)
+					{
+						AsciiToSymbol[Char] = NumSymbols;
+					}
+					else
+					{
+						OtherToSymbol.Add(Char, NumSymbols);
+					}
+					NumSymbols++;
+				}
+			}
+		}
+
+		const auto AddNode = [&](const int32 Depth)
+		{
+			Transitions.AddUninitialized(NumSymbols);
+			for (int32 Symbol = 0; Symbol < NumSymbols; Symbol++)
+			{
+				Transitions.Last(Symbol) = -1;
+			}
+			Nodes.Add({ Depth });
+			return Nodes.Num() - 1;
+		};
+		AddNode(0);
+
+		for (const FPattern& Pattern : Patterns)
+		{
+			int32 Node = 0;
+			for (const TCHAR Char : Pattern.Text)
+			{
+				const int32 Transition = Node * NumSymbols + GetSymbol(Char);
+				if (Transitions[Transition] == -1)
+				{
+					const int32 NewNode = AddNode(Nodes[Node].Depth + 1);
+					Transitions[Transition] = NewNode;
+				}
+				Node = Transitions[Transition];
+			}
+
+			uint8& Type = Pattern.Match == EMatch::Prefix ? Nodes[Node].PrefixType : Nodes[Node].ContainsType;
+			Type = FMath::Max(Type, uint8(Pattern.Type));
+		}
+
+		// Breadth first to compute failure links and turn the trie into a DFA
+		TArray<int32> FailureLinks;
+		FailureLinks.Init(0, Nodes.Num());
+
+		TArray<int32> Queue;
+		for (int32 Symbol = 0; Symbol < NumSymbols; Symbol++)
+		{
+			int32& Child = Transitions[Symbol];
+			if (Child == -1)
+			{
+				Child = 0;
+			}
+			else
+			{
+				Queue.Add(Child);
+			}
+		}
+
+		for (int32 QueueIndex = 0; QueueIndex < Queue.Num(); QueueIndex++)
+		{
+			const int32 Node = Queue[QueueIndex];
+			const int32 FailureLink = FailureLinks[Node];
+
+			// Patterns ending at our longest proper suffix also end here
+			Nodes[Node].ContainsType = FMath::Max(Nodes[Node].ContainsType, Nodes[FailureLink].ContainsType);
+
+			for (int32 Symbol = 0; Symbol < NumSymbols; Symbol++)
+			{
+				int32& Child = Transitions[Node * NumSymbols + Symbol];
+				if (Child == -1)
+				{
+					Child = Transitions[FailureLink * NumSymbols + Symbol];
+				}
+				else
+				{
+					FailureLinks[Child] = Transitions[FailureLink * NumSymbols + Symbol];
+					Queue.Add(Child);
+				}
+			}
+		}
+	}
+
+	EExecLineType Classify(const FStringView Line) const
+	{
+		check(NumSymbols > 0);
+
+		uint8 Result = uint8(EExecLineType::Normal);
+		int32 Node = 0;
+
+		for (int32 Index = 0; Index < Line.Len(); Index++)
+		{
+			Node = Transitions[Node * NumSymbols + GetSymbol(FChar::ToLower(Line[Index]))];
+
+			const FNode& NodeInfo = Nodes[Node];
+			Result = FMath::Max(Result, NodeInfo.ContainsType);
+
+			// A prefix pattern matched if its node is reached after exactly as many characters as its length
+			if (NodeInfo.Depth == Index + 1)
+			{
+				Result = FMath::Max(Result, NodeInfo.PrefixType);
+			}
+
+			if (Result == uint8(EExecLineType::Suppressed))
+			{
+				break;
+			}
+		}
+
+		return EExecLineType(Result);
+	}
+
+private:
+	struct FPattern
+	{
+		EExecLineType Type = {};
+		EMatch Match = {};
+		FString Text;
+	};
+	struct FNode
+	{
+		int32 Depth = 0;
+		uint8 ContainsType = 0;
+		uint8 PrefixType = 0;
+	};
+
+	TArray<FPattern> Patterns;
+
+	int32 NumSymbols = 0;
+	int32 AsciiToSymbol[128];
+	TMap<TCHAR, int32> OtherToSymbol;
+
+	TArray<FNode> Nodes;
+	TArray<int32> Transitions;
+
+	int32 GetSymbol(const TCHAR Char) const
+	{
+		if (Char < 128)
+		{
+			return AsciiToSymbol[Char];
+		}
+		return OtherToSymbol.FindRef(Char);
+	}
+};
+
+const FExecLineClassifier& GetExecLineClassifier()
+{
+	static const FExecLineClassifier Classifier = INLINE_LAMBDA
+	{
+		FExecLineClassifier Result;
+
+		using EMatch = FExecLineClassifier::EMatch;
+
+		Result.Add(EExecLineType::Suppressed, EMatch::Prefix, "Warning: Permanently added 'github.com'");
+		Result.Add(EExecLineType::Suppressed, EMatch::Prefix, "Your branch is up to date");
+		Result.Add(EExecLineType::Suppressed, EMatch::Prefix, "Already on");
+		Result.Add(EExecLineType::Suppressed, EMatch::Prefix, "Already up to date.");
+
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "0 Warning(s)");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "0 Error(s)");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "Failed to create pipeline state with combined hash");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "Failed to create compute PSO with combined hash");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "Failed to create compute pipeline with hash");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "no platform load command found");
+		Result.Add(EExecLineType::Ignored, EMatch::Contains, "LogRHI: Error: Shader:");
+
+		Result.Add(EExecLineType::Error, EMatch::Contains, "error");
+		Result.Add(EExecLineType::Error, EMatch::Prefix, "D:\\Perforce\\");
+		Result.Add(EExecLineType::Warning, EMatch::Contains, "warning");
+
+		const FString ProjectFilters = FPaths::ConvertRelativePathToFull(FPaths::ProjectConfigDir()) / "ForgeOutputFilters.txt";
+		if (FileExists(ProjectFilters))
+		{
+			Result.LoadFile(ProjectFilters);
+		}
+
+		Result.Compile();
+		return Result;
+	};
+	return Classifier;
+}
+
+EExecLineType ClassifyExecLine(const FStringView Line)
+{
+	return GetExecLineClassifier().Classify(Line);
+}
+
+FString FExecDiagnostic::ToString() const
+{
+	FString Result = File;
+	if (Line > 0)
+	{
+		Result += Column > 0
+			? FString::Printf(TEXT("(%d,%d)"), Line, Column)
+			: FString::Printf(TEXT("(%d)"), Line);
+	}
+	if (!Result.IsEmpty())
+	{
+		Result += ": ";
+	}
+
+	Result += Severity == EExecLineType::Error ? "error" : "warning";
+	if (!Code.IsEmpty())
+	{
+		Result += " " + Code;
+	}
+	return Result + ": " + Message;
+}
+
+bool IsDigits(const FStringView Text)
+{
+	if (Text.IsEmpty())
+	{
+		return false;
+	}
+
+	for (const TCHAR Char : Text)
+	{
+		if (!FChar::IsDigit(Char))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Unlike StringToInt, doesn't fatal: build output can contain anything, eg leading zeros or huge numbers
+// Returns 0 if Text isn't a positive number fitting in an int32
+int32 ParseDiagnosticNumber(const FStringView Text)
+{
+	if (!IsDigits(Text))
+	{
+		return 0;
+	}
+
+	int64 Result = 0;
+	for (const TCHAR Char : Text)
+	{
+		Result = Result * 10 + (Char - TEXT('0'));
+		if (Result > MAX_int32)
+		{
+			return 0;
+		}
+	}
+	return int32(Result);
+}
+
+// Parses file(line), file(line,column), file:line and file:line:column
+// A line or column that fails to parse is treated as no location
+void ParseDiagnosticLocation(
+	FStringView Location,
+	FExecDiagnostic& Diagnostic)
+{
+	Location = Location.TrimStartAndEnd();
+
+	if (Location.EndsWith(TEXT(')')))
+	{
+		int32 OpenIndex = INDEX_NONE;
+		if (Location.FindLastChar(TEXT('('), OpenIndex))
+		{
+			const FStringView Inside = Location.Mid(OpenIndex + 1, Location.Len() - OpenIndex - 2);
+
+			int32 CommaIndex = INDEX_NONE;
+			const FStringView LineText = Inside.FindChar(TEXT(','), CommaIndex) ? Inside.Left(CommaIndex) : Inside;
+			const FStringView ColumnText = CommaIndex != INDEX_NONE ? Inside.RightChop(CommaIndex + 1) : FStringView();
+
+			if (IsDigits(LineText))
+			{
+				Diagnostic.File = FString(Location.Left(OpenIndex));
+				Diagnostic.Line = ParseDiagnosticNumber(LineText);
+				Diagnostic.Column = Diagnostic.Line > 0 ? ParseDiagnosticNumber(ColumnText) : 0;
+				return;
+			}
+		}
+	}
+
+	// Up to two trailing :number, without eating a drive letter
+	TArray<int32, TInlineAllocator<2>> Numbers;
+	while (Numbers.Num() < 2)
+	{
+		int32 ColonIndex = INDEX_NONE;
+		if (!Location.FindLastChar(TEXT(':'), ColonIndex) ||
+			!IsDigits(Location.RightChop(ColonIndex + 1)))
+		{
+			break;
+		}
+
+		Numbers.Insert(ParseDiagnosticNumber(Location.RightChop(ColonIndex + 1)), 0);
+		Location = Location.Left(ColonIndex);
+	}
+
+	Diagnostic.File = FString(Location);
+	Diagnostic.Line = Numbers.Num() > 0 ? Numbers[0] : 0;
+	Diagnostic.Column = Numbers.Num() > 1 && Diagnostic.Line > 0 ? Numbers[1] : 0;
+}
+
+bool FExecDiagnosticParser::Parse(
+	FStringView Text,
+	FExecDiagnostic& OutDiagnostic)
+{
+	Text = Text.TrimStartAndEnd();
+
+	// Unreal log timestamp and frame counter: [2024.01.01-00.00.00:000][  0]
+	while (Text.StartsWith(TEXT('[')))
+	{
+		int32 CloseIndex = INDEX_NONE;
+		if (!Text.FindChar(TEXT(']'), CloseIndex))
+		{
+			break;
+		}
+		Text = Text.RightChop(CloseIndex + 1);
+	}
+
+	struct FMarker
+	{
+		const TCHAR* Text;
+		EExecLineType Severity;
+		// If true the marker must start the line, eg UAT ERROR: lines
+		bool bAtStart;
+	};
+	static const FMarker Markers[] =
+	{
+		// clang, MSVC and linkers
+		{ TEXT(": fatal error"), EExecLineType::Error, false },
+		{ TEXT(": error"), EExecLineType::Error, false },
+		{ TEXT(": warning"), EExecLineType::Warning, false },
+		// Unreal logs: LogCategory: Error: message
+		{ TEXT(": Error:"), EExecLineType::Error, false },
+		{ TEXT(": Warning:"), EExecLineType::Warning, false },
+		// UAT and UBT
+		{ TEXT("ERROR:"), EExecLineType::Error, true },
+		{ TEXT("Error:"), EExecLineType::Error, true },
+		{ TEXT("WARNING:"), EExecLineType::Warning, true },
+		{ TEXT("Warning:"), EExecLineType::Warning, true },
+	};
+
+	const FString TextString(Text);
+
+	const FMarker* FoundMarker = nullptr;
+	int32 FoundIndex = MAX_int32;
+	for (const FMarker& Marker : Markers)
+	{
+		const int32 Index = Marker.bAtStart
+			? (TextString.StartsWith(Marker.Text, ESearchCase::CaseSensitive) ? 0 : INDEX_NONE)
+			: TextString.Find(Marker.Text, ESearchCase::CaseSensitive);
+
+		if (Index != INDEX_NONE &&
+			Index < FoundIndex)
+		{
+			FoundMarker = &Marker;
+			FoundIndex = Index;
+		}
+	}
+
+	if (!FoundMarker)
+	{
+		return false;
+	}
+
+	FExecDiagnostic Diagnostic;
+	Diagnostic.Severity = FoundMarker->Severity;
+
+	FStringView Location = Text.Left(FoundIndex);
+	FStringView Rest = Text.RightChop(FoundIndex + FCString::Strlen(FoundMarker->Text));
+
+	if (!FoundMarker->bAtStart &&
+		!Rest.StartsWith(TEXT(':')))
+	{
+		// error C2065: message, warning LNK4098: message
+		// Anything else is probably not a diagnostic, eg "Compiling: error_handling.cpp"
+		if (!Rest.StartsWith(TEXT(' ')))
+		{
+			return false;
+		}
+
+		int32 ColonIndex = INDEX_NONE;
+		if (!Rest.FindChar(TEXT(':'), ColonIndex))
+		{
+			return false;
+		}
+
+		const FStringView Code = Rest.Mid(1, ColonIndex - 1);
+		for (const TCHAR Char : Code)
+		{
+			if (!FChar::IsAlnum(Char))
+			{
+				return false;
+			}
+		}
+
+		Diagnostic.Code = FString(Code);
+		Rest = Rest.RightChop(ColonIndex);
+	}
+
+	Rest.RemovePrefix(Rest.StartsWith(TEXT(':')) ? 1 : 0);
+	Diagnostic.Message = FString(Rest.TrimStartAndEnd());
+
+	if (Diagnostic.Message.IsEmpty())
+	{
+		return false;
+	}
+
+	// clang: message [-Wflag]
+	if (Diagnostic.Code.IsEmpty() &&
+		Diagnostic.Message.EndsWith("]"))
+	{
+		const int32 OpenIndex = Diagnostic.Message.Find(TEXT(" [-W"), ESearchCase::CaseSensitive, ESearchDir::FromEnd);
+		if (OpenIndex != INDEX_NONE)
+		{
+			Diagnostic.Code = Diagnostic.Message.Mid(OpenIndex + 2, Diagnostic.Message.Len() - OpenIndex - 3);
+			Diagnostic.Message.LeftInline(OpenIndex);
+		}
+	}
+
+	int32 SpaceIndex = INDEX_NONE;
+	if (Location.TrimStartAndEnd().StartsWith(TEXT("Log")) &&
+		!Location.TrimStartAndEnd().FindChar(TEXT(' '), SpaceIndex))
+	{
+		// Unreal log category
+		Diagnostic.Code = FString(Location.TrimStartAndEnd());
+	}
+	else if (!Location.IsEmpty())
+	{
+		ParseDiagnosticLocation(Location, Diagnostic);
+	}
+
+	OutDiagnostic = MoveTemp(Diagnostic);
+	return true;
+}
+
+void FExecDiagnosticParser::AddLine(const FString& Line)
+{
+	const EExecLineType Type = ClassifyExecLine(Line);
+	if (Type == EExecLineType::Ignored ||
+		Type == EExecLineType::Suppressed)
+	{
+		return;
+	}
+
+	FExecDiagnostic Diagnostic;
+	if (!Parse(Line, Diagnostic))
+	{
+		return;
+	}
+
+	// The same diagnostic is printed once per translation unit including the header, or once per template instantiation
+	const FString Key = FString::Printf(TEXT("%d|%s|%d|%d|%s|%s"),
+		int32(Diagnostic.Severity),
+		*FPaths::ConvertRelativePathToFull(Diagnostic.File).ToLower(),
+		Diagnostic.Line,
+		Diagnostic.Column,
+		*Diagnostic.Code,
+		*Diagnostic.Message);
+
+	if (const int32* Index = KeyToIndex.Find(Key))
+	{
+		Diagnostics[*Index].Count++;
+		return;
+	}
+
+	KeyToIndex.Add(Key, Diagnostics.Num());
+	Diagnostics.Add(Diagnostic);
+
+	if (Diagnostic.Severity == EExecLineType::Error)
+	{
+		NumErrors++;
+	}
+
+	if (OnDiagnostic)
+	{
+		OnDiagnostic(Diagnostic);
+	}
+}
+
+void FExecDiagnosticParser::LogTeamCityInspection(const FExecDiagnostic& Diagnostic)
+{
+	const FString TypeId = Diagnostic.Code.IsEmpty()
+		? (Diagnostic.Severity == EExecLineType::Error ? "error" : "warning")
+		: Diagnostic.Code;
+
+	{
+		static FCriticalSection CriticalSection;
+		static TSet<FString> LoggedTypes;
+
+		FScopeLock Lock(&CriticalSection);
+
+		if (!LoggedTypes.Contains(TypeId))
+		{
+			LoggedTypes.Add(TypeId);
+
+			LOG("##teamcity[inspectionType id='%s' name='%s' category='Build' description='%s']",
+				*EscapeTeamCity(TypeId),
+				*EscapeTeamCity(TypeId),
+				*EscapeTeamCity(TypeId));
+		}
+	}
+
+	LOG("##teamcity[inspection typeId='%s' message='%s' file='%s' line='%d' SEVERITY='%s']",
+		*EscapeTeamCity(TypeId),
+		*EscapeTeamCity(Diagnostic.Message),
+		*EscapeTeamCity(Diagnostic.File),
+		Diagnostic.Line,
+		Diagnostic.Severity == EExecLineType::Error ? TEXT("ERROR") : TEXT("WARNING"));
+}
+
+struct FExecStats
+{
+	FString Label;
+	FString CommandLine;
+	int32 ExitCode = 0;
+	double WallTime = 0;
+	double UserTime = 0;
+	double SystemTime = 0;
+	int64 PeakMemory = 0;
+	int64 BytesRead = 0;
+	int64 BytesWritten = 0;
+};
+
+FCriticalSection GForgeExecStatsCriticalSection;
+TArray<FExecStats> GForgeExecStats;
+
+// Program name and sub command, eg "git fetch" or "RunUAT.bat BuildPlugin"
+FString GetExecLabel(const FString& CommandLine)
+{
+	const TCHAR* Stream = *CommandLine;
+
+	FString Program;
+	if (!FParse::Token(Stream, Program, false))
+	{
+		return CommandLine;
+	}
+
+	FString Label = FPaths::GetCleanFilename(Program);
+
+	FString Command;
+	if (FParse::Token(Stream, Command, false) &&
+		!Command.StartsWith("-") &&
+		!Command.Contains("/") &&
+		!Command.Contains("\\"))
+	{
+		Label += " " + Command;
+	}
+
+	return Label;
+}
+
+FCriticalSection GForgeExecEnvironmentCriticalSection;
+// Set by SetupLinuxToolchainFor, added to the environment of every command
+TMap<FString, FString> GForgeExecEnvironment;
+
+TMap<FString, FString> GetExecEnvironment()
+{
+	FScopeLock Lock(&GForgeExecEnvironmentCriticalSection);
+	return GForgeExecEnvironment;
+}
+
+struct FExecParams
+{
+	FString CommandLine;
+	// Copied so that a concurrent SetWorkingDirectory cannot change it under us
+	FString WorkingDirectory = GetWorkingDirectory();
+	bool bAllowFailure = false;
+	TSet<int32> ValidExitCodes = { 0 };
+	// Prepended to every logged line, to tell apart commands running in parallel
+	FString LogPrefix;
+	// Set in the environment of the command only, the process environment is left untouched
+	TMap<FString, FString> Environment = GetExecEnvironment();
+	// If set, output is streamed to OnLine line by line and only the last MaxTailLines are kept in Output
+	TFunction<void(const FString& Line)> OnLine;
+	int32 MaxTailLines = 0;
+	// Set for commands that don't modify the repository, eg by Exec_Cached, so they don't invalidate its cache
+	bool bIsReadOnly = false;
+};
+
+FCriticalSection GForgeExecCacheCriticalSection;
+// Working directory -> command line + invalidation token -> output
+TMap<FString, TMap<FString, FString>> GForgeExecCache;
+// Incremented by every invalidation, so that a cached command running concurrently with a git command doesn't store its output
+uint64 GForgeExecCacheGeneration = 0;
+
+void InvalidateExecCache(const FString& WorkingDirectory)
+{
+	FScopeLock Lock(&GForgeExecCacheCriticalSection);
+	GForgeExecCache.Remove(FPaths::ConvertRelativePathToFull(WorkingDirectory));
+	GForgeExecCacheGeneration++;
+}
+
+bool ExecImpl(
+	const FExecParams& Params,
+	FString& Output,
+	int32& OutReturnCode)
+{
+	const FString& CommandLine = Params.CommandLine;
+	const FString& WorkingDirectory = Params.WorkingDirectory;
+
+	check(!WorkingDirectory.IsEmpty());
+	check(FPaths::DirectoryExists(WorkingDirectory));
+
+	LOG("%s%s", *Params.LogPrefix, *CommandLine);
+
+	// Any git command we don't know about might move HEAD or change the tree
+	// Invalidated once it's done, anything cached while it runs might be from before the change
+	const bool bInvalidatesCache =
+		!Params.bIsReadOnly &&
+		CommandLine.StartsWith("git ");
+
+	ON_SCOPE_EXIT
+	{
+		if (bInvalidatesCache)
+		{
+			InvalidateExecCache(WorkingDirectory);
+		}
+	};
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	FExecStats Stats;
+	Stats.Label = GetExecLabel(CommandLine);
+	Stats.CommandLine = CommandLine;
+
+	TArray<FString> TailLines;
+	int32 TailIndex = 0;
+
+	const auto ProcessLine = [&](FString Line)
+	{
+		if (Params.OnLine)
+		{
+			Params.OnLine(Line);
+
+			if (TailLines.Num() < Params.MaxTailLines)
+			{
+				TailLines.Add(Line);
+			}
+			else if (Params.MaxTailLines > 0)
+			{
+				TailLines[TailIndex] = Line;
+				TailIndex = (TailIndex + 1) % Params.MaxTailLines;
+			}
+		}
+		else
+		{
+			Output += Line + "\n";
+		}
+
+		Line.TrimStartAndEndInline();
+
+		if (Line.IsEmpty())
+		{
+			return;
+		}
+
+		if (ClassifyExecLine(Line) == EExecLineType::Suppressed)
+		{
+			return;
+		}
+
+		LOG("\t%s%s", *Params.LogPrefix, *Line);
+	};
+
+	FUtf8LineSplitter LineSplitter;
+
+#if PLATFORM_WINDOWS
+	void* PipeRead = nullptr;
+	void* PipeWrite = nullptr;
+	check(FPlatformProcess::CreatePipe(PipeRead, PipeWrite));
+
+	FString ShellCommandLine = CommandLine;
+	for (const auto& It : Params.Environment)
+	{
+		ShellCommandLine = "set \"" + It.Key + "=" + It.Value + "\"&& " + ShellCommandLine;
+	}
+
+	FProcHandle ProcHandle = FPlatformProcess::CreateProc(
+		TEXT("cmd.exe"),
+		*("/c \"" + ShellCommandLine + "\""),
+		false,
+		false,
+		false,
+		nullptr,
+		0,
+		*WorkingDirectory,
+		PipeWrite,
+		nullptr,
+		PipeWrite);
+	check(ProcHandle.IsValid());
+
+	// Track the whole process tree, not just cmd.exe
+	// Children spawned before the assignment are missed, but cmd.exe takes a few ms to start anything
+	const HANDLE JobHandle = CreateJobObjectW(nullptr, nullptr);
+	if (JobHandle)
+	{
+		AssignProcessToJobObject(JobHandle, ProcHandle.Get());
+	}
+
+	TArray<uint8> Buffer;
+	const auto FlushReadPipe = [&]
+	{
+		bool bHasReadAnything = false;
+		while (
+			FPlatformProcess::ReadPipeToArray(PipeRead, Buffer) &&
+			Buffer.Num() > 0)
+		{
+			bHasReadAnything = true;
+
+			LineSplitter.Append(Buffer, ProcessLine);
+		}
+		return bHasReadAnything;
+	};
+
+	double LastReadTime = FPlatformTime::Seconds();
+	while (FPlatformProcess::IsProcRunning(ProcHandle))
+	{
+		FPlatformProcess::Sleep(0.01f);
+
+		if (FlushReadPipe())
+		{
+			LastReadTime = FPlatformTime::Seconds();
+		}
+
+		if (FPlatformTime::Seconds() - LastReadTime > 30)
+		{
+			LastReadTime = FPlatformTime::Seconds();
+
+			LOG("[Waiting for command]");
+		}
+	}
+
+	int32 ReturnCode = 1;
+	check(FPlatformProcess::GetProcReturnCode(ProcHandle, &ReturnCode));
+
+	if (JobHandle)
+	{
+		JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION AccountingInfo;
+		if (QueryInformationJobObject(JobHandle, JobObjectBasicAndIoAccountingInformation, &AccountingInfo, sizeof(AccountingInfo), nullptr))
+		{
+			Stats.UserTime = AccountingInfo.BasicInfo.TotalUserTime.QuadPart / 1.e7;
+			Stats.SystemTime = AccountingInfo.BasicInfo.TotalKernelTime.QuadPart / 1.e7;
+			Stats.BytesRead = AccountingInfo.IoInfo.ReadTransferCount;
+			Stats.BytesWritten = AccountingInfo.IoInfo.WriteTransferCount;
+		}
+
+		JOBOBJECT_EXTENDED_LIMIT_INFORMATION LimitInfo;
+		if (QueryInformationJobObject(JobHandle, JobObjectExtendedLimitInformation, &LimitInfo, sizeof(LimitInfo), nullptr))
+		{
+			Stats.PeakMemory = LimitInfo.PeakJobMemoryUsed;
+		}
+
+		CloseHandle(JobHandle);
+	}
+
+	FPlatformProcess::CloseProc(ProcHandle);
+
+	FlushReadPipe();
+	LineSplitter.Flush(ProcessLine);
+
+	FPlatformProcess::ClosePipe(PipeRead, PipeWrite);
+#else
+	// Spawn the process ourselves: simple commands are run directly without a shell,
+	// everything else goes through bash -c. Nothing is written to disk, so this is safe to call from multiple threads.
+	using FAddChdir = int(*)(posix_spawn_file_actions_t*, const char*);
+	static const FAddChdir AddChdir = reinterpret_cast<FAddChdir>(dlsym(RTLD_DEFAULT, "posix_spawn_file_actions_addchdir_np"));
+
+	TArray<FString> Arguments;
+	if (!AddChdir ||
+		!ParseCommandLineArguments(CommandLine, Arguments))
+	{
+		FString Script = CommandLine;
+		if (!AddChdir)
+		{
+			Script = "cd '" + WorkingDirectory.Replace(TEXT("'"), TEXT("'\\''")) + "' || exit 1\n" + Script;
+		}
+
+		Arguments = { "/bin/bash", "-c", Script };
+	}
+
+	TArray<TArray<ANSICHAR>> Utf8Arguments;
+	for (const FString& Argument : Arguments)
+	{
+		const FTCHARToUTF8 Utf8Argument(*Argument);
+		Utf8Arguments.Emplace(reinterpret_cast<const ANSICHAR*>(Utf8Argument.Get()), Utf8Argument.Length() + 1);
+	}
+
+	TArray<char*> Argv;
+	for (TArray<ANSICHAR>& Utf8Argument : Utf8Arguments)
+	{
+		Argv.Add(Utf8Argument.GetData());
+	}
+	Argv.Add(nullptr);
+
+	// Copy of our environment with the overrides applied
+	TArray<TArray<ANSICHAR>> Utf8Environment;
+	TArray<char*> Envp;
+	if (Params.Environment.Num() > 0)
+	{
+		for (char** Variable = GetEnvironment(); *Variable; Variable++)
+		{
+			const ANSICHAR* Equal = FCStringAnsi::Strchr(*Variable, '=');
+			const FString Name(Equal ? int32(Equal - *Variable) : FCStringAnsi::Strlen(*Variable), *Variable);
+			if (!Params.Environment.Contains(Name))
+			{
+				Utf8Environment.Emplace(*Variable, FCStringAnsi::Strlen(*Variable) + 1);
+			}
+		}
+
+		for (const auto& It : Params.Environment)
+		{
+			const FTCHARToUTF8 Utf8Variable(*(It.Key + "=" + It.Value));
+			Utf8Environment.Emplace(reinterpret_cast<const ANSICHAR*>(Utf8Variable.Get()), Utf8Variable.Length() + 1);
+		}
+
+		for (TArray<ANSICHAR>& Variable : Utf8Environment)
+		{
+			Envp.Add(Variable.GetData());
+		}
+		Envp.Add(nullptr);
+	}
+
+	int32 PipeFds[2];
+#if PLATFORM_LINUX
+	check(pipe2(PipeFds, O_CLOEXEC) == 0);
+#else
+	check(pipe(PipeFds) == 0);
+	fcntl(PipeFds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(PipeFds[1], F_SETFD, FD_CLOEXEC);
+#endif
+	fcntl(PipeFds[0], F_SETFL, fcntl(PipeFds[0], F_GETFL) | O_NONBLOCK);
+
+	posix_spawn_file_actions_t FileActions;
+	check(posix_spawn_file_actions_init(&FileActions) == 0);
+	check(posix_spawn_file_actions_adddup2(&FileActions, PipeFds[1], STDOUT_FILENO) == 0);
+	check(posix_spawn_file_actions_adddup2(&FileActions, PipeFds[1], STDERR_FILENO) == 0);
+
+	if (AddChdir)
+	{
+		check(AddChdir(&FileActions, TCHAR_TO_UTF8(*WorkingDirectory)) == 0);
+	}
+
+	posix_spawnattr_t Attributes;
+	check(posix_spawnattr_init(&Attributes) == 0);
+	check(posix_spawnattr_setflags(&Attributes, GetSpawnFlags()) == 0);
+	check(posix_spawnattr_setsigmask(&Attributes, &GetSpawnSignals().Mask) == 0);
+	check(posix_spawnattr_setsigdefault(&Attributes, &GetSpawnSignals().Default) == 0);
+
+	pid_t ProcessId = -1;
+	const int32 SpawnError = posix_spawnp(
+		&ProcessId,
+		Argv[0],
+		&FileActions,
+		&Attributes,
+		Argv.GetData(),
+		Envp.Num() > 0 ? Envp.GetData() : GetEnvironment());
+
+	posix_spawnattr_destroy(&Attributes);
+	posix_spawn_file_actions_destroy(&FileActions);
+
+	// Only the child should hold the write end, so that we get EOF once it's done
+	close(PipeFds[1]);
+
+	int32 PipeFd = PipeFds[0];
+	ON_SCOPE_EXIT
+	{
+		if (PipeFd != -1)
+		{
+			close(PipeFd);
+		}
+	};
+
+	const auto FlushReadPipe = [&]
+	{
+		bool bHasReadAnything = false;
+		while (PipeFd != -1)
+		{
+			uint8 Buffer[16384];
+			const ssize_t Count = read(PipeFd, Buffer, sizeof(Buffer));
+
+			if (Count > 0)
+			{
+				bHasReadAnything = true;
+
+				LineSplitter.Append(MakeArrayView(Buffer, int32(Count)), ProcessLine);
+				continue;
+			}
+
+			if (Count == -1 &&
+				errno == EINTR)
+			{
+				continue;
+			}
+
+			if (Count == 0 ||
+				errno != EAGAIN)
+			{
+				// EOF: stop polling the pipe, it would always be readable
+				close(PipeFd);
+				PipeFd = -1;
+			}
+			break;
+		}
+		return bHasReadAnything;
+	};
+
+	int32 ReturnCode = 1;
+	const auto TryReap = [&]
+	{
+		if (ProcessId == -1)
+		{
+			return true;
+		}
+
+		int32 Status = 0;
+		rusage Usage;
+		FMemory::Memzero(Usage);
+
+		// wait4 also gives us the resource usage of the child and of all the descendants it waited for
+		const pid_t Result = wait4(ProcessId, &Status, WNOHANG, &Usage);
+		if (Result == 0 ||
+			(Result == -1 && errno == EINTR))
+		{
+			return false;
+		}
+		check(Result == ProcessId);
+
+		Stats.UserTime = Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec / 1.e6;
+		Stats.SystemTime = Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec / 1.e6;
+#if PLATFORM_MAC
+		Stats.PeakMemory = Usage.ru_maxrss;
+#else
+		Stats.PeakMemory = int64(Usage.ru_maxrss) * 1024;
+#endif
+#if PLATFORM_LINUX
+		// Same block accounting as read_bytes/write_bytes in /proc/<pid>/io
+		Stats.BytesRead = int64(Usage.ru_inblock) * 512;
+		Stats.BytesWritten = int64(Usage.ru_oublock) * 512;
+#endif
+
+		if (WIFEXITED(Status))
+		{
+			ReturnCode = WEXITSTATUS(Status);
+		}
+		else if (WIFSIGNALED(Status))
+		{
+			ReturnCode = 128 + WTERMSIG(Status);
+		}
+		return true;
+	};
+
+	if (SpawnError != 0)
+	{
+		// Match what bash would do for a missing command
+		ProcessLine(FString::Printf(TEXT("%s: %s"), *Arguments[0], UTF8_TO_TCHAR(strerror(SpawnError))));
+		ReturnCode = 127;
+	}
+
+#if PLATFORM_LINUX
+	// Block until the child writes something or exits instead of sleep-polling
+	// If pidfd_open is not available (kernel < 5.3) we still wake up on output, and check for exit every 10ms
+	const int32 ProcessFd = ProcessId == -1 ? -1 : syscall(SYS_pidfd_open, ProcessId, 0);
+#else
+	const int32 ProcessFd = -1;
+#endif
+	ON_SCOPE_EXIT
+	{
+		if (ProcessFd != -1)
+		{
+			close(ProcessFd);
+		}
+	};
+
+	const auto WaitForActivity = [&](const double Timeout)
+	{
+		pollfd Fds[2];
+		Fds[0].fd = ProcessFd;
+		Fds[0].events = POLLIN;
+		Fds[0].revents = 0;
+		Fds[1].fd = PipeFd;
+		Fds[1].events = POLLIN;
+		Fds[1].revents = 0;
+
+		const int32 TimeoutMs =
+			ProcessFd == -1
+			? 10
+			: FMath::Clamp(FMath::CeilToInt(Timeout * 1000), 1, 30 * 1000);
+
+		if (poll(Fds, 2, TimeoutMs) == -1)
+		{
+			check(errno == EINTR);
+		}
+	};
+
+#if PLATFORM_LINUX
+	FProcessTreeSampler ProcessTreeSampler(ProcessId, StartTime);
+#endif
+
+	double LastReadTime = FPlatformTime::Seconds();
+	while (!TryReap())
+	{
+		WaitForActivity(LastReadTime + 30 - FPlatformTime::Seconds());
+
+		if (FlushReadPipe())
+		{
+			LastReadTime = FPlatformTime::Seconds();
+		}
+
+		if (FPlatformTime::Seconds() - LastReadTime > 30)
+		{
+			LastReadTime = FPlatformTime::Seconds();
+
+#if PLATFORM_LINUX
+			ProcessTreeSampler.LogSample(Params.LogPrefix);
+#else
+			LOG("[Waiting for command]");
+#endif
+		}
+	}
+
+	FlushReadPipe();
+	LineSplitter.Flush(ProcessLine);
+#endif
+
+	OutReturnCode = ReturnCode;
+
+	Stats.ExitCode = ReturnCode;
+	Stats.WallTime = FPlatformTime::Seconds() - StartTime;
+
+	if (Stats.WallTime > 1)
+	{
+		LOG("%s[%s took %s: CPU %s user %s system, peak memory %s, read %s, written %s]",
+			*Params.LogPrefix,
+			*Stats.Label,
+			*SecondsToString(Stats.WallTime),
+			*SecondsToString(Stats.UserTime),
+			*SecondsToString(Stats.SystemTime),
+			*BytesToString(Stats.PeakMemory),
+			*BytesToString(Stats.BytesRead),
+			*BytesToString(Stats.BytesWritten));
+	}
+
+	{
+		FScopeLock Lock(&GForgeExecStatsCriticalSection);
+		GForgeExecStats.Add(MoveTemp(Stats));
+	}
+
+	if (Params.OnLine)
+	{
+		check(Output.IsEmpty());
+
+		for (int32 Index = 0; Index < TailLines.Num(); Index++)
+		{
+			Output += TailLines[(TailIndex + Index) % TailLines.Num()] + "\n";
+		}
+	}
+
+	if (!Params.ValidExitCodes.Contains(ReturnCode))
+	{
+		if (Params.bAllowFailure)
+		{
+			return false;
+		}
+
+		LOG_FATAL("%s returned %d\nWorking directory: %s", *CommandLine, ReturnCode, *WorkingDirectory);
+	}
+
+	Output.RemoveFromEnd("\n");
+	return true;
+}
+
+FString Exec(
+	const FString& CommandLine,
+	const TSet<int32>& ValidExitCodes)
+{
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.ValidExitCodes = ValidExitCodes;
+
+	FString Output;
+	int32 ReturnCode = 0;
+	check(ExecImpl(Params, Output, ReturnCode));
+	return Output;
+}
+
+FString Exec_Cached(
+	const FString& CommandLine,
+	const FString& InvalidationToken)
+{
+	const FString WorkingDirectory = FPaths::ConvertRelativePathToFull(GetWorkingDirectory());
+	const FString Key = CommandLine + "\n" + InvalidationToken;
+
+	{
+		FScopeLock Lock(&GForgeExecCacheCriticalSection);
+
+		if (const TMap<FString, FString>* Outputs = GForgeExecCache.Find(WorkingDirectory))
+		{
+			if (const FString* Output = Outputs->Find(Key))
+			{
+				LOG("%s [cached]", *CommandLine);
+				return *Output;
+			}
+		}
+	}
+
+	uint64 Generation = 0;
+	{
+		FScopeLock Lock(&GForgeExecCacheCriticalSection);
+		Generation = GForgeExecCacheGeneration;
+	}
+
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.bIsReadOnly = true;
+
+	FString Output;
+	int32 ReturnCode = 0;
+	check(ExecImpl(Params, Output, ReturnCode));
+
+	FScopeLock Lock(&GForgeExecCacheCriticalSection);
+	if (Generation == GForgeExecCacheGeneration)
+	{
+		GForgeExecCache.FindOrAdd(WorkingDirectory).Add(Key, Output);
+	}
+
+	return Output;
+}
+
+void InvalidateExecCache()
+{
+	InvalidateExecCache(GetWorkingDirectory());
+}
+
+// Classifies output lines as they arrive and reports the errors of a failed command
+// Shared by Exec_PostErrors and the FExecGraph nodes with bPostErrors set
+class FExecErrorReporter
+{
+public:
+	explicit FExecErrorReporter(const FString& LogPrefix = {})
+		: LogPrefix(LogPrefix)
+	{
+		DiagnosticParser.OnDiagnostic = [this](const FExecDiagnostic& Diagnostic)
+		{
+			FExecDiagnosticParser::LogTeamCityInspection(Diagnostic);
+
+			// Report the first error right away, the build might take a while to fail
+			if (Diagnostic.Severity == EExecLineType::Error &&
+				DiagnosticParser.GetNumErrors() == 1)
+			{
+				LOG("##teamcity[message text='%sFirst error: %s' status='ERROR']", *EscapeTeamCity(this->LogPrefix), *EscapeTeamCity(Diagnostic.ToString()));
+			}
+		};
+	}
+	UE_NONCOPYABLE(FExecErrorReporter);
+
+	void AddLine(const FString& RawLine)
+	{
+		const FString Line = RawLine.TrimStartAndEnd();
+		if (Line.IsEmpty())
+		{
+			return;
+		}
+
+		const EExecLineType Type = ClassifyExecLine(Line);
+		if (Type == EExecLineType::Error ||
+			Type == EExecLineType::Warning)
+		{
+			Lines.Add(Line);
+		}
+
+		DiagnosticParser.AddLine(Line);
+	}
+
+	// Posts the error and warning lines to TeamCity, returns the errors to show in the failure message
+	TArray<FString> ReportErrors() const
+	{
+		for (const FString& Line : Lines)
+		{
+			LOG("##teamcity[message text='%s%s' status='ERROR']", *EscapeTeamCity(LogPrefix), *EscapeTeamCity(Line));
+		}
+
+		// Prefer the parsed errors, deduplicated, over raw lines
+		if (DiagnosticParser.GetNumErrors() == 0)
+		{
+			return Lines;
+		}
+
+		TArray<FString> Errors;
+		for (const FExecDiagnostic& Diagnostic : DiagnosticParser.GetDiagnostics())
+		{
+			if (Diagnostic.Severity == EExecLineType::Error)
+			{
+				Errors.Add(Diagnostic.ToString());
+			}
+		}
+		return Errors;
+	}
+
+private:
+	const FString LogPrefix;
+	TArray<FString> Lines;
+	FExecDiagnosticParser DiagnosticParser;
+};
+
+FString Exec_PostErrors(
+	const FString& CommandLine,
+	const TSet<int32>& ValidExitCodes,
+	const int32 MaxOutputLines)
+{
+	LOG("##teamcity[compilationStarted compiler='Execute']");
+
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.bAllowFailure = true;
+	Params.ValidExitCodes = ValidExitCodes;
+	Params.MaxTailLines = MaxOutputLines;
+
+	// Parse diagnostics as they arrive instead of re-parsing the whole output at the end
+	FExecErrorReporter ErrorReporter;
+	Params.OnLine = [&](const FString& Line)
+	{
+		ErrorReporter.AddLine(Line);
+	};
+
+	FString Tail;
+	int32 ReturnCode = 0;
+	const bool bSuccess = ExecImpl(Params, Tail, ReturnCode);
+
+	LOG("##teamcity[compilationFinished compiler='Execute']");
+
+	if (bSuccess)
+	{
+		return Tail;
+	}
+
+	TArray<FString> Errors = ErrorReporter.ReportErrors();
+	Errors.SetNum(FMath::Min(Errors.Num(), 10));
+
+	FString Message = "```\n";
+	for (const FString& Error : Errors)
+	{
+		Message += Error + "\n";
+	}
+	Message += "```";
+
+	PostFatalSlackMessage(Message);
+	return {};
+}
+
+bool TryExec(
+	const FString& CommandLine,
+	const TSet<int32>& ValidExitCodes)
+{
+	FString Output;
+	return TryExec(CommandLine, Output, ValidExitCodes);
+}
+
+bool TryExec(
+	const FString& CommandLine,
+	FString& Output,
+	const TSet<int32>& ValidExitCodes)
+{
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.bAllowFailure = true;
+	Params.ValidExitCodes = ValidExitCodes;
+
+	int32 ReturnCode = 0;
+	return ExecImpl(Params, Output, ReturnCode);
+}
+
+FString Exec(
+	const FString& CommandLine,
+	const TFunctionRef<void(const FString& Line)> OnLine,
+	const int32 MaxTailLines,
+	const TSet<int32>& ValidExitCodes)
+{
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.ValidExitCodes = ValidExitCodes;
+	Params.OnLine = [&](const FString& Line)
+	{
+		OnLine(Line);
+	};
+	Params.MaxTailLines = MaxTailLines;
+
+	FString Tail;
+	int32 ReturnCode = 0;
+	check(ExecImpl(Params, Tail, ReturnCode));
+	return Tail;
+}
+
+bool TryExec(
+	const FString& CommandLine,
+	const TFunctionRef<void(const FString& Line)> OnLine,
+	FString& Tail,
+	const int32 MaxTailLines,
+	const TSet<int32>& ValidExitCodes)
+{
+	FExecParams Params;
+	Params.CommandLine = CommandLine;
+	Params.bAllowFailure = true;
+	Params.ValidExitCodes = ValidExitCodes;
+	Params.OnLine = [&](const FString& Line)
+	{
+		OnLine(Line);
+	};
+	Params.MaxTailLines = MaxTailLines;
+
+	int32 ReturnCode = 0;
+	return ExecImpl(Params, Tail, ReturnCode);
+}
+
+// Aggregates the stats of every command run so far per label, reports them to TeamCity and saves them as json
+void LogExecStats()
+{
+	TArray<FExecStats> AllStats;
+	{
+		FScopeLock Lock(&GForgeExecStatsCriticalSection);
+		AllStats = GForgeExecStats;
+	}
+
+	if (AllStats.Num() == 0)
+	{
+		return;
+	}
+
+	LOG_SCOPE("Exec statistics");
+
+	TMap<FString, FExecStats> LabelToTotal;
+	TMap<FString, int32> LabelToCount;
+	TArray<TSharedPtr<FJsonValue>> CommandsJson;
+
+	for (const FExecStats& Stats : AllStats)
+	{
+		FExecStats& Total = LabelToTotal.FindOrAdd(Stats.Label);
+		Total.Label = Stats.Label;
+		Total.WallTime += Stats.WallTime;
+		Total.UserTime += Stats.UserTime;
+		Total.SystemTime += Stats.SystemTime;
+		Total.PeakMemory = FMath::Max(Total.PeakMemory, Stats.PeakMemory);
+		Total.BytesRead += Stats.BytesRead;
+		Total.BytesWritten += Stats.BytesWritten;
+		LabelToCount.FindOrAdd(Stats.Label)++;
+
+		const TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+		Json->SetStringField("label", Stats.Label);
+		Json->SetStringField("commandLine", Stats.CommandLine);
+		Json->SetNumberField("exitCode", Stats.ExitCode);
+		Json->SetNumberField("wallTime", Stats.WallTime);
+		Json->SetNumberField("userTime", Stats.UserTime);
+		Json->SetNumberField("systemTime", Stats.SystemTime);
+		Json->SetNumberField("peakMemory", Stats.PeakMemory);
+		Json->SetNumberField("bytesRead", Stats.BytesRead);
+		Json->SetNumberField("bytesWritten", Stats.BytesWritten);
+		CommandsJson.Add(MakeShared<FJsonValueObject>(Json));
+	}
+
+	LabelToTotal.ValueSort([](const FExecStats& A, const FExecStats& B)
+	{
+		return A.WallTime > B.WallTime;
+	});
+
+	TArray<TSharedPtr<FJsonValue>> TotalsJson;
+	for (const auto& It : LabelToTotal)
+	{
+		const FExecStats& Total = It.Value;
+		const int32 Count = LabelToCount[It.Key];
+
+		LOG("%s: %d calls, %s wall, %s user, %s system, peak memory %s, read %s, written %s",
+			*Total.Label,
+			Count,
+			*SecondsToString(Total.WallTime),
+			*SecondsToString(Total.UserTime),
+			*SecondsToString(Total.SystemTime),
+			*BytesToString(Total.PeakMemory),
+			*BytesToString(Total.BytesRead),
+			*BytesToString(Total.BytesWritten));
+
+		const FString Key = "Forge.Exec." + Total.Label.Replace(TEXT(" "), TEXT("_"));
+		const auto LogStatistic = [&](const TCHAR* Name, const double Value)
+		{
+			LOG("##teamcity[buildStatisticValue key='%s' value='%f']", *EscapeTeamCity(Key + "." + Name), Value);
+		};
+		LogStatistic(TEXT("Count"), Count);
+		LogStatistic(TEXT("WallTime"), Total.WallTime);
+		LogStatistic(TEXT("UserTime"), Total.UserTime);
+		LogStatistic(TEXT("SystemTime"), Total.SystemTime);
+		LogStatistic(TEXT("PeakMemory"), Total.PeakMemory);
+		LogStatistic(TEXT("BytesRead"), Total.BytesRead);
+		LogStatistic(TEXT("BytesWritten"), Total.BytesWritten);
+
+		const TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+		Json->SetStringField("label", Total.Label);
+		Json->SetNumberField("count", Count);
+		Json->SetNumberField("wallTime", Total.WallTime);
+		Json->SetNumberField("userTime", Total.UserTime);
+		Json->SetNumberField("systemTime", Total.SystemTime);
+		Json->SetNumberField("peakMemory", Total.PeakMemory);
+		Json->SetNumberField("bytesRead", Total.BytesRead);
+		Json->SetNumberField("bytesWritten", Total.BytesWritten);
+		TotalsJson.Add(MakeShared<FJsonValueObject>(Json));
+	}
+
+	const TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+	Json->SetArrayField("totals", TotalsJson);
+	Json->SetArrayField("commands", CommandsJson);
+
+	const FString Path = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) / "ForgeExecStats.json";
+	SaveTextFile(Path, JsonToString(Json, true));
+
+	LOG("##teamcity[publishArtifacts '%s']", *EscapeTeamCity(Path));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+int32 FExecGraph::Add(
+	const FString& Name,
+	const FString& CommandLine,
+	const TArray<int32>& Dependencies,
+	const int32 Weight,
+	const int64 Memory)
+{
+	for (const int32 Dependency : Dependencies)
+	{
+		check(Nodes.IsValidIndex(Dependency));
+	}
+	check(Weight >= 1);
+	check(Memory >= 0);
+
+	FNode& Node = Nodes.Emplace_GetRef();
+	Node.Name = Name;
+	Node.CommandLine = CommandLine;
+	Node.WorkingDirectory = GetWorkingDirectory();
+	Node.Dependencies = Dependencies;
+	Node.Weight = Weight;
+	Node.Memory = Memory;
+	return Nodes.Num() - 1;
+}
+
+bool FExecGraph::TryRun(
+	int32 MaxSlots,
+	int64 MaxMemory)
+{
+	if (MaxSlots <= 0)
+	{
+		MaxSlots = FMath::Max(1, FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+	}
+	if (MaxMemory <= 0)
+	{
+		MaxMemory = int64(FPlatformMemory::GetStats().AvailablePhysical);
+	}
+
+	LOG_SCOPE("ExecGraph");
+	LOG("Running %d commands with %d slots and %s of memory", Nodes.Num(), MaxSlots, *BytesToString(MaxMemory));
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	enum class EState : uint8
+	{
+		Pending,
+		Running,
+		Done
+	};
+	TArray<EState> States;
+	States.Init(EState::Pending, Nodes.Num());
+
+	FCriticalSection CriticalSection;
+	TArray<int32> FinishedNodes;
+
+	FEvent* Event = FPlatformProcess::GetSynchEventFromPool();
+	ON_SCOPE_EXIT
+	{
+		FPlatformProcess::ReturnSynchEventToPool(Event);
+	};
+
+	// A node bigger than the whole budget still runs, alone
+	const auto GetSlots = [&](const FNode& Node)
+	{
+		return FMath::Min(Node.Weight, MaxSlots);
+	};
+	const auto GetMemory = [&](const FNode& Node)
+	{
+		return FMath::Min(Node.Memory, MaxMemory);
+	};
+
+	TArray<TFuture<void>> Futures;
+	int32 NumRunning = 0;
+	int32 UsedSlots = 0;
+	int64 UsedMemory = 0;
+	bool bSuccess = true;
+
+	while (true)
+	{
+		TArray<int32> NewFinishedNodes;
+		{
+			FScopeLock Lock(&CriticalSection);
+			NewFinishedNodes = MoveTemp(FinishedNodes);
+		}
+
+		for (const int32 Index : NewFinishedNodes)
+		{
+			const FNode& Node = Nodes[Index];
+			States[Index] = EState::Done;
+
+			NumRunning--;
+			UsedSlots -= GetSlots(Node);
+			UsedMemory -= GetMemory(Node);
+
+			if (Node.bSuccess)
+			{
+				LOG("[%s] done in %s", *Node.Name, *SecondsToString(Node.Duration));
+			}
+			else
+			{
+				LOG("[%s] failed with exit code %d after %s", *Node.Name, Node.ExitCode, *SecondsToString(Node.Duration));
+				bSuccess = false;
+			}
+		}
+
+		// Dependencies always have a lower index, so a single pass is enough to propagate skips
+		for (int32 Index = 0; Index < Nodes.Num(); Index++)
+		{
+			FNode& Node = Nodes[Index];
+			if (States[Index] != EState::Pending)
+			{
+				continue;
+			}
+
+			bool bIsReady = true;
+			bool bShouldSkip = false;
+			for (const int32 Dependency : Node.Dependencies)
+			{
+				if (States[Dependency] != EState::Done)
+				{
+					bIsReady = false;
+				}
+				else if (!Nodes[Dependency].bSuccess)
+				{
+					bShouldSkip = true;
+				}
+			}
+
+			if (bShouldSkip)
+			{
+				LOG("[%s] skipped: a dependency failed", *Node.Name);
+
+				States[Index] = EState::Done;
+				Node.bSkipped = true;
+				bSuccess = false;
+				continue;
+			}
+
+			if (!bIsReady)
+			{
+				continue;
+			}
+
+			if (NumRunning > 0 &&
+				(UsedSlots + GetSlots(Node) > MaxSlots || UsedMemory + GetMemory(Node) > MaxMemory))
+			{
+				continue;
+			}
+
+			States[Index] = EState::Running;
+			NumRunning++;
+			UsedSlots += GetSlots(Node);
+			UsedMemory += GetMemory(Node);
+
+			Futures.Add(Async(EAsyncExecution::Thread, [this, Index, Event, &CriticalSection, &FinishedNodes]
+			{
+				FNode& LocalNode = Nodes[Index];
+
+				FExecParams Params;
+				Params.CommandLine = LocalNode.CommandLine;
+				Params.WorkingDirectory = LocalNode.WorkingDirectory;
+				Params.Environment.Append(LocalNode.Environment);
+				Params.bAllowFailure = true;
+				Params.ValidExitCodes = LocalNode.ValidExitCodes;
+				Params.LogPrefix = "[" + LocalNode.Name + "] ";
+
+				TUniquePtr<FExecErrorReporter> ErrorReporter;
+				if (LocalNode.bPostErrors)
+				{
+					ErrorReporter = MakeUnique<FExecErrorReporter>(Params.LogPrefix);
+					Params.OnLine = [&](const FString& Line)
+					{
+						ErrorReporter->AddLine(Line);
+					};
+					Params.MaxTailLines = 10000;
+				}
+
+				if (LocalNode.OnStart)
+				{
+					LocalNode.OnStart();
+				}
+
+				const double NodeStartTime = FPlatformTime::Seconds();
+				LocalNode.bSuccess = ExecImpl(Params, LocalNode.Output, LocalNode.ExitCode);
+				LocalNode.Duration = FPlatformTime::Seconds() - NodeStartTime;
+
+				if (ErrorReporter &&
+					!LocalNode.bSuccess)
+				{
+					LocalNode.Errors = ErrorReporter->ReportErrors();
+				}
+
+				FScopeLock Lock(&CriticalSection);
+				FinishedNodes.Add(Index);
+				Event->Trigger();
+			}));
+		}
+
+		if (NumRunning == 0)
+		{
+			break;
+		}
+
+		Event->Wait();
+	}
+
+	for (const TFuture<void>& Future : Futures)
+	{
+		Future.Wait();
+	}
+
+	LOG("ExecGraph took %s", *SecondsToString(FPlatformTime::Seconds() - StartTime));
+
+	return bSuccess;
+}
+
+void FExecGraph::Run(
+	const int32 MaxSlots,
+	const int64 MaxMemory)
+{
+	if (TryRun(MaxSlots, MaxMemory))
+	{
+		return;
+	}
+
+	FString Message;
+	for (const FNode& Node : Nodes)
+	{
+		if (Node.bSkipped)
+		{
+			Message += FString::Printf(TEXT("%s: skipped\n"), *Node.Name);
+		}
+		else if (!Node.bSuccess)
+		{
+			Message += FString::Printf(TEXT("%s: %s returned %d\n"), *Node.Name, *Node.CommandLine, Node.ExitCode);
+		}
+	}
+
+	LOG_FATAL("ExecGraph failed:\n%s", *Message);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// Reads the repository metadata directly instead of spawning git
+// Every function returns an unset optional if it finds something it doesn't handle, callers then fall back to git
+struct FGitDirectories
+{
+	// Per worktree: HEAD and worktree-local refs
+	FString GitDir;
+	// Shared: objects, refs, packed-refs
+	FString CommonDir;
+};
+
+TOptional<FGitDirectories> Git_FindDirectories(const FString& WorkingDirectory)
+{
+	FString Directory = FPaths::ConvertRelativePathToFull(WorkingDirectory);
+	FPaths::NormalizeDirectoryName(Directory);
+
+	while (!Directory.IsEmpty())
+	{
+		const FString DotGit = Directory / ".git";
+
+		FGitDirectories Result;
+		if (DirectoryExists(DotGit))
+		{
+			Result.GitDir = DotGit;
+		}
+		else if (FileExists(DotGit))
+		{
+			// Worktrees and submodules: "gitdir: <path>", relative to the .git file
+			FString GitDir = LoadTextFile(DotGit).TrimStartAndEnd();
+			if (!GitDir.RemoveFromStart("gitdir: "))
+			{
+				return {};
+			}
+
+			GitDir = FPaths::ConvertRelativePathToFull(Directory, GitDir);
+			if (!DirectoryExists(GitDir))
+			{
+				return {};
+			}
+			Result.GitDir = GitDir;
+		}
+		else
+		{
+			const FString Parent = FPaths::GetPath(Directory);
+			if (Parent == Directory)
+			{
+				return {};
+			}
+			Directory = Parent;
+			continue;
+		}
+
+		Result.CommonDir = Result.GitDir;
+
+		const FString CommonDirFile = Result.GitDir / "commondir";
+		if (FileExists(CommonDirFile))
+		{
+			Result.CommonDir = FPaths::ConvertRelativePathToFull(Result.GitDir, LoadTextFile(CommonDirFile).TrimStartAndEnd());
+		}
+
+		// Reftable repositories are not supported, SHA-256 ones are rejected by Git_IsObjectId
+		if (DirectoryExists(Result.CommonDir / "reftable"))
+		{
+			return {};
+		}
+
+		return Result;
+	}
+
+	return {};
+}
+
+bool Git_IsObjectId(const FString& Text)
+{
+	if (Text.Len() != 40)
+	{
+		return false;
+	}
+
+	for (const TCHAR Char : Text)
+	{
+		if (!FChar::IsHexDigit(Char))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+TOptional<FString> Git_ResolveRef(
+	const FGitDirectories& Directories,
+	FString Ref)
+{
+	// Follow symbolic refs, same depth limit as git
+	for (int32 Depth = 0; Depth < 5; Depth++)
+	{
+		FString Value;
+
+		for (const FString& Directory : { Directories.GitDir, Directories.CommonDir })
+		{
+			const FString Path = Directory / Ref;
+			if (FileExists(Path))
+			{
+				Value = LoadTextFile(Path).TrimStartAndEnd();
+				break;
+			}
+		}
+
+		if (Value.IsEmpty())
+		{
+			const FString PackedRefsPath = Directories.CommonDir / "packed-refs";
+			if (!FileExists(PackedRefsPath))
+			{
+				return {};
+			}
+
+			TArray<FString> Lines;
+			LoadTextFile(PackedRefsPath).ParseIntoArrayLines(Lines);
+
+			for (const FString& Line : Lines)
+			{
+				// "<id> <ref>", skipping the header and peeled tags
+				if (Line.Len() > 41 &&
+					Line[40] == TEXT(' ') &&
+					FStringView(Line).RightChop(41).Equals(Ref, ESearchCase::CaseSensitive))
+				{
+					Value = Line.Left(40);
+					break;
+				}
+			}
+
+			if (Value.IsEmpty())
+			{
+				return {};
+			}
+		}
+
+		if (Git_IsObjectId(Value))
+		{
+			return Value.ToLower();
+		}
+
+		if (!Value.RemoveFromStart("ref: "))
+		{
+			return {};
+		}
+		Ref = Value;
+	}
+
+	return {};
+}
+
+TOptional<FString> Git_TryGetRevision_Native(const FString& WorkingDirectory)
+{
+	const TOptional<FGitDirectories> Directories = Git_FindDirectories(WorkingDirectory);
+	if (!Directories)
+	{
+		return {};
+	}
+
+	return Git_ResolveRef(*Directories, "HEAD");
+}
+
+// Number of hex digits needed for Revision to be unambiguous among all the objects of the repository
+// Uses the fanout table of every pack index to only look at objects sharing the first byte
+TOptional<int32> Git_TryGetUniquePrefixLength_Native(
+	const FString& WorkingDirectory,
+	const FString& Revision)
+{
+	const TOptional<FGitDirectories> Directories = Git_FindDirectories(WorkingDirectory);
+	if (!Directories ||
+		!Git_IsObjectId(Revision))
+	{
+		return {};
+	}
+
+	uint8 Id[20];
+	check(HexToBytes(Revision, Id) == 20);
+
+	const auto GetCommonHexDigits = [&](const uint8* OtherId)
+	{
+		int32 Result = 0;
+		for (int32 Index = 0; Index < 20; Index++)
+		{
+			if (Id[Index] == OtherId[Index])
+			{
+				Result += 2;
+				continue;
+			}
+			if ((Id[Index] >> 4) == (OtherId[Index] >> 4))
+			{
+				Result++;
+			}
+			break;
+		}
+		return Result;
+	};
+
+	int32 MaxCommonHexDigits = 0;
+
+	TArray<FString> ObjectDirectories = { Directories->CommonDir / "objects" };
+	{
+		const FString AlternatesPath = Directories->CommonDir / "objects" / "info" / "alternates";
+		if (FileExists(AlternatesPath))
+		{
+			TArray<FString> Lines;
+			LoadTextFile(AlternatesPath).ParseIntoArrayLines(Lines);
+
+			for (const FString& Line : Lines)
+			{
+				if (!Line.StartsWith("#"))
+				{
+					ObjectDirectories.Add(FPaths::ConvertRelativePathToFull(Directories->CommonDir / "objects", Line.TrimStartAndEnd()));
+				}
+			}
+		}
+	}
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	for (const FString& ObjectDirectory : ObjectDirectories)
+	{
+		if (!DirectoryExists(ObjectDirectory))
+		{
+			return {};
+		}
+
+		// Loose objects: objects/ab/cdef...
+		const FString LooseDirectory = ObjectDirectory / Revision.Left(2);
+		if (DirectoryExists(LooseDirectory))
+		{
+			for (const FString& Name : ListChildren_FileNames(LooseDirectory))
+			{
+				const FString OtherRevision = Revision.Left(2) + Name.ToLower();
+				if (!Git_IsObjectId(OtherRevision) ||
+					OtherRevision == Revision)
+				{
+					continue;
+				}
+
+				uint8 OtherId[20];
+				HexToBytes(OtherRevision, OtherId);
+				MaxCommonHexDigits = FMath::Max(MaxCommonHexDigits, GetCommonHexDigits(OtherId));
+			}
+		}
+
+		const FString PackDirectory = ObjectDirectory / "pack";
+		if (!DirectoryExists(PackDirectory))
+		{
+			continue;
+		}
+
+		for (const FString& Name : ListChildren_FileNames(PackDirectory))
+		{
+			if (!Name.EndsWith(".idx"))
+			{
+				continue;
+			}
+
+			const TUniquePtr<IFileHandle> File(PlatformFile.OpenRead(*(PackDirectory / Name)));
+			if (!File)
+			{
+				return {};
+			}
+
+			// v2: magic, version, fanout, ids. v1: fanout, then 4 byte offset + id entries
+			uint8 Header[8];
+			if (!File->Read(Header, 8))
+			{
+				return {};
+			}
+
+			const bool bIsVersion2 =
+				Header[0] == 0xFF && Header[1] == 't' && Header[2] == 'O' && Header[3] == 'c' &&
+				Header[4] == 0 && Header[5] == 0 && Header[6] == 0 && Header[7] == 2;
+
+			const int64 FanoutOffset = bIsVersion2 ? 8 : 0;
+			const int64 EntriesOffset = FanoutOffset + 256 * 4;
+			const int64 EntrySize = bIsVersion2 ? 20 : 24;
+			const int64 IdOffset = bIsVersion2 ? 0 : 4;
+
+			uint8 Fanout[256 * 4];
+			if (!File->Seek(FanoutOffset) ||
+				!File->Read(Fanout, sizeof(Fanout)))
+			{
+				return {};
+			}
+
+			const auto GetFanout = [&](const int32 Index) -> int64
+			{
+				const uint8* Data = &Fanout[Index * 4];
+				return (uint32(Data[0]) << 24) | (uint32(Data[1]) << 16) | (uint32(Data[2]) << 8) | uint32(Data[3]);
+			};
+
+			const int64 Start = Id[0] == 0 ? 0 : GetFanout(Id[0] - 1);
+			const int64 End = GetFanout(Id[0]);
+			if (Start >= End)
+			{
+				continue;
+			}
+
+			TArray64<uint8> Entries;
+			Entries.SetNumUninitialized((End - Start) * EntrySize);
+			if (!File->Seek(EntriesOffset + Start * EntrySize) ||
+				!File->Read(Entries.GetData(), Entries.Num()))
+			{
+				return {};
+			}
+
+			for (int64 Index = 0; Index < End - Start; Index++)
+			{
+				const uint8* OtherId = &Entries[Index * EntrySize + IdOffset];
+				if (FMemory::Memcmp(OtherId, Id, 20) == 0)
+				{
+					continue;
+				}
+
+				MaxCommonHexDigits = FMath::Max(MaxCommonHexDigits, GetCommonHexDigits(OtherId));
+			}
+		}
+	}
+
+	// Same rule as git rev-parse --short=4: never shorter than 4 digits
+	return FMath::Max(MaxCommonHexDigits + 1, 4);
+}
+
+// Reader for objects/info/commit-graph, or a split commit-graph chain
+// Positions are global across all the layers of a chain, base layers first
+class FGitCommitGraph
+{
+public:
+	static TUniquePtr<FGitCommitGraph> Load(const FString& ObjectDirectory)
+	{
+		TArray<FString> Paths;
+
+		const FString SinglePath = ObjectDirectory / "info" / "commit-graph";
+		const FString ChainPath = ObjectDirectory / "info" / "commit-graphs" / "commit-graph-chain";
+
+		if (FileExists(SinglePath))
+		{
+			Paths.Add(SinglePath);
+		}
+		else if (FileExists(ChainPath))
+		{
+			TArray<FString> Hashes;
+			LoadTextFile(ChainPath).ParseIntoArrayLines(Hashes);
+
+			for (const FString& Hash : Hashes)
+			{
+				Paths.Add(ObjectDirectory / "info" / "commit-graphs" / "graph-" + Hash.TrimStartAndEnd() + ".graph");
+			}
+		}
+
+		if (Paths.Num() == 0)
+		{
+			return nullptr;
+		}
+
+		TUniquePtr<FGitCommitGraph> Graph = MakeUnique<FGitCommitGraph>();
+
+		for (const FString& Path : Paths)
+		{
+			if (!FileExists(Path))
+			{
+				return nullptr;
+			}
+
+			FLayer& Layer = Graph->Layers.Emplace_GetRef();
+			Layer.Data = LoadBinaryFile(Path);
+			Layer.BaseCommits = Graph->NumCommits;
+
+			if (!Layer.Parse())
+			{
+				LOG("Unsupported commit-graph: %s", *Path);
+				return nullptr;
+			}
+
+			Graph->NumCommits += Layer.NumCommits;
+		}
+
+		return Graph;
+	}
+
+	int32 Num() const
+	{
+		return NumCommits;
+	}
+
+	TOptional<int32> Find(const uint8* Id) const
+	{
+		for (const FLayer& Layer : Layers)
+		{
+			int32 Start = Id[0] == 0 ? 0 : ReadUint32(Layer.Fanout + (Id[0] - 1) * 4);
+			int32 End = ReadUint32(Layer.Fanout + Id[0] * 4);
+
+			while (Start < End)
+			{
+				const int32 Middle = (Start + End) / 2;
+				const int32 Compare = FMemory::Memcmp(Layer.Ids + Middle * 20, Id, 20);
+
+				if (Compare == 0)
+				{
+					return Layer.BaseCommits + Middle;
+				}
+
+				if (Compare < 0)
+				{
+					Start = Middle + 1;
+				}
+				else
+				{
+					End = Middle;
+				}
+			}
+		}
+		return {};
+	}
+
+	FString GetId(const int32 Position) const
+	{
+		const FLayer& Layer = FindLayer(Position);
+		return BytesToHex(Layer.Ids + (Position - Layer.BaseCommits) * 20, 20).ToLower();
+	}
+
+	// Topological level, 0 if the graph was written without generation numbers
+	uint32 GetLevel(const int32 Position) const
+	{
+		return ReadUint32(GetCommitData(Position) + 28) >> 2;
+	}
+
+	template<typename LambdaType>
+	void ForeachParent(const int32 Position, LambdaType&& Lambda) const
+	{
+		constexpr uint32 NoParent = 0x70000000;
+		constexpr uint32 ExtraEdges = 0x80000000;
+		constexpr uint32 LastEdge = 0x80000000;
+
+		const uint8* CommitData = GetCommitData(Position);
+
+		const uint32 FirstParent = ReadUint32(CommitData + 20);
+		if (FirstParent == NoParent)
+		{
+			return;
+		}
+		Lambda(int32(FirstParent));
+
+		const uint32 SecondParent = ReadUint32(CommitData + 24);
+		if (SecondParent == NoParent)
+		{
+			return;
+		}
+
+		if (!(SecondParent & ExtraEdges))
+		{
+			Lambda(int32(SecondParent));
+			return;
+		}
+
+		// Octopus merge: the remaining parents are in the EDGE chunk, the last one is flagged
+		const FLayer& Layer = FindLayer(Position);
+		check(Layer.ExtraEdges);
+
+		for (const uint8* Edge = Layer.ExtraEdges + (SecondParent & ~ExtraEdges) * 4; ; Edge += 4)
+		{
+			const uint32 Parent = ReadUint32(Edge);
+			Lambda(int32(Parent & ~LastEdge));
+
+			if (Parent & LastEdge)
+			{
+				break;
+			}
+		}
+	}
+
+private:
+	struct FLayer
+	{
+		TArray64<uint8> Data;
+		int32 BaseCommits = 0;
+		int32 NumCommits = 0;
+		const uint8* Fanout = nullptr;
+		const uint8* Ids = nullptr;
+		const uint8* CommitData = nullptr;
+		const uint8* ExtraEdges = nullptr;
+
+		bool Parse()
+		{
+			// "CGPH", version 1, SHA-1, number of chunks, number of base graphs
+			if (Data.Num() < 8 ||
+				FMemory::Memcmp(Data.GetData(), "CGPH", 4) != 0 ||
+				Data[4] != 1 ||
+				Data[5] != 1)
+			{
+				return false;
+			}
+
+			const int32 NumChunks = Data[6];
+			if (Data.Num() < 8 + (NumChunks + 1) * 12)
+			{
+				return false;
+			}
+
+			// The table has one more entry than there are chunks, its offset is the end of the last chunk
+			int64 FanoutSize = -1;
+			int64 IdsSize = -1;
+			int64 CommitDataSize = -1;
+			int64 ExtraEdgesSize = 0;
+
+			for (int32 Index = 0; Index < NumChunks; Index++)
+			{
+				const uint8* Entry = &Data[8 + Index * 12];
+				const uint8* NextEntry = Entry + 12;
+				const uint64 Offset = (uint64(ReadUint32(Entry + 4)) << 32) | ReadUint32(Entry + 8);
+				const uint64 NextOffset = (uint64(ReadUint32(NextEntry + 4)) << 32) | ReadUint32(NextEntry + 8);
+				if (Offset > NextOffset ||
+					NextOffset > uint64(Data.Num()))
+				{
+					return false;
+				}
+
+				const uint8* Chunk = Data.GetData() + Offset;
+				const int64 Size = NextOffset - Offset;
+
+				if (FMemory::Memcmp(Entry, "OIDF", 4) == 0)
+				{
+					Fanout = Chunk;
+					FanoutSize = Size;
+				}
+				else if (FMemory::Memcmp(Entry, "OIDL", 4) == 0)
+				{
+					Ids = Chunk;
+					IdsSize = Size;
+				}
+				else if (FMemory::Memcmp(Entry, "CDAT", 4) == 0)
+				{
+					CommitData = Chunk;
+					CommitDataSize = Size;
+				}
+				else if (FMemory::Memcmp(Entry, "EDGE", 4) == 0)
+				{
+					ExtraEdges = Chunk;
+					ExtraEdgesSize = Size;
+				}
+			}
+
+			if (!Fanout ||
+				!Ids ||
+				!CommitData ||
+				FanoutSize != 256 * 4)
+			{
+				return false;
+			}
+
+			const uint32 TotalCommits = ReadUint32(Fanout + 255 * 4);
+			if (TotalCommits > uint32(MAX_int32 - BaseCommits) ||
+				IdsSize != int64(TotalCommits) * 20 ||
+				CommitDataSize != int64(TotalCommits) * 36 ||
+				ExtraEdgesSize % 4 != 0)
+			{
+				return false;
+			}
+			NumCommits = TotalCommits;
+
+			for (int32 Index = 1; Index < 256; Index++)
+			{
+				if (ReadUint32(Fanout + (Index - 1) * 4) > ReadUint32(Fanout + Index * 4))
+				{
+					return false;
+				}
+			}
+
+			// Parents can be in this layer or in the base layers, never in the layers above
+			constexpr uint32 NoParent = 0x70000000;
+			constexpr uint32 ExtraEdgeFlag = 0x80000000;
+			const uint32 MaxParent = BaseCommits + NumCommits;
+			const int64 NumExtraEdges = ExtraEdgesSize / 4;
+
+			for (int32 Index = 0; Index < NumCommits; Index++)
+			{
+				const uint8* Commit = CommitData + int64(Index) * 36;
+
+				const uint32 FirstParent = ReadUint32(Commit + 20);
+				if (FirstParent != NoParent &&
+					FirstParent >= MaxParent)
+				{
+					return false;
+				}
+
+				const uint32 SecondParent = ReadUint32(Commit + 24);
+				if (SecondParent == NoParent)
+				{
+					continue;
+				}
+
+				if (!(SecondParent & ExtraEdgeFlag))
+				{
+					if (SecondParent >= MaxParent)
+					{
+						return false;
+					}
+					continue;
+				}
+
+				for (int64 Edge = SecondParent & ~ExtraEdgeFlag; ; Edge++)
+				{
+					if (Edge >= NumExtraEdges ||
+						(ReadUint32(ExtraEdges + Edge * 4) & ~ExtraEdgeFlag) >= MaxParent)
+					{
+						return false;
+					}
+					if (ReadUint32(ExtraEdges + Edge * 4) & ExtraEdgeFlag)
+					{
+						break;
+					}
+				}
+			}
+
+			return true;
+		}
+	};
+	TArray<FLayer> Layers;
+	int32 NumCommits = 0;
+
+	static uint32 ReadUint32(const uint8* Data)
+	{
+		return (uint32(Data[0]) << 24) | (uint32(Data[1]) << 16) | (uint32(Data[2]) << 8) | uint32(Data[3]);
+	}
+
+	const FLayer& FindLayer(const int32 Position) const
+	{
+		for (const FLayer& Layer : Layers)
+		{
+			if (Position < Layer.BaseCommits + Layer.NumCommits)
+			{
+				return Layer;
+			}
+		}
+
+		LOG_FATAL("Invalid commit-graph position %d", Position);
+		return Layers[0];
+	}
+
+	// Tree id, first parent, second parent, generation and commit time
+	const uint8* GetCommitData(const int32 Position) const
+	{
+		const FLayer& Layer = FindLayer(Position);
+		return Layer.CommitData + (Position - Layer.BaseCommits) * 36;
+	}
+};
+
+// Number of commits reachable from Head
+int32 Git_CountAncestors(
+	const FGitCommitGraph& Graph,
+	const int32 Head)
+{
+	TBitArray<> Visited(false, Graph.Num());
+	TArray<int32> Stack = { Head };
+	Visited[Head] = true;
+
+	int32 Count = 0;
+	while (Stack.Num() > 0)
+	{
+		const int32 Position = Stack.Pop();
+		Count++;
+
+		Graph.ForeachParent(Position, [&](const int32 Parent)
+		{
+			if (!Visited[Parent])
+			{
+				Visited[Parent] = true;
+				Stack.Add(Parent);
+			}
+		});
+	}
+	return Count;
+}
+
+// Number of commits reachable from Head but not from Base, like git rev-list --count Base..Head
+// Walks by decreasing topological level and stops as soon as only commits reachable from Base are left
+TOptional<int32> Git_CountAncestorsSince(
+	const FGitCommitGraph& Graph,
+	const int32 Head,
+	const int32 Base)
+{
+	if (Graph.GetLevel(Head) == 0 ||
+		Graph.GetLevel(Base) == 0)
+	{
+		return {};
+	}
+
+	constexpr uint8 FromHead = 1;
+	constexpr uint8 FromBase = 2;
+
+	TMap<int32, uint8> Flags;
+	TArray<int32> Heap;
+	int32 NumQueuedFromHeadOnly = 0;
+
+	const auto Predicate = [&](const int32 A, const int32 B)
+	{
+		return Graph.GetLevel(A) > Graph.GetLevel(B);
+	};
+
+	const auto AddFlags = [&](const int32 Position, const uint8 NewFlags)
+	{
+		uint8* ExistingFlags = Flags.Find(Position);
+		if (!ExistingFlags)
+		{
+			Flags.Add(Position, NewFlags);
+			Heap.HeapPush(Position, Predicate);
+
+			if (NewFlags == FromHead)
+			{
+				NumQueuedFromHeadOnly++;
+			}
+			return;
+		}
+
+		if ((*ExistingFlags | NewFlags) == *ExistingFlags)
+		{
+			return;
+		}
+
+		// Only queued commits can still gain flags: popped ones have a higher level than all their ancestors
+		if (*ExistingFlags == FromHead)
+		{
+			NumQueuedFromHeadOnly--;
+		}
+		*ExistingFlags |= NewFlags;
+	};
+
+	AddFlags(Head, FromHead);
+	AddFlags(Base, FromBase);
+
+	int32 Count = 0;
+	while (NumQueuedFromHeadOnly > 0)
+	{
+		int32 Position;
+		Heap.HeapPop(Position, Predicate);
+
+		const uint8 PositionFlags = Flags[Position];
+		if (PositionFlags == FromHead)
+		{
+			NumQueuedFromHeadOnly--;
+			Count++;
+		}
+
+		Graph.ForeachParent(Position, [&](const int32 Parent)
+		{
+			if (Graph.GetLevel(Parent) == 0)
+			{
+				return;
+			}
+			AddFlags(Parent, PositionFlags);
+		});
+	}
+
+	return Count;
+}
+
+FCriticalSection GForgeChangelistCacheCriticalSection;
+
+// Commit id -> number of commits reachable from it, persisted across runs
+TMap<FString, int32>& GetChangelistCache()
+{
+	static TMap<FString, int32> Cache = INLINE_LAMBDA
+	{
+		TMap<FString, int32> Result;
+
+		const FString Path = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) / "ForgeChangelists.txt";
+		if (!FileExists(Path))
+		{
+			return Result;
+		}
+
+		TArray<FString> Lines;
+		LoadTextFile(Path).ParseIntoArrayLines(Lines);
+
+		for (const FString& Line : Lines)
+		{
+			FString Revision;
+			FString Count;
+			if (Line.Split(" ", &Revision, &Count) &&
+				Git_IsObjectId(Revision))
+			{
+				Result.Add(Revision, FCString::Atoi(*Count));
+			}
+		}
+		return Result;
+	};
+	return Cache;
+}
+
+void AddToChangelistCache(
+	const FString& Revision,
+	const int32 Changelist)
+{
+	TMap<FString, int32>& Cache = GetChangelistCache();
+	if (Cache.Contains(Revision))
+	{
+		return;
+	}
+	Cache.Add(Revision, Changelist);
+
+	const FString Path = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) / "ForgeChangelists.txt";
+	const FString Line = FString::Printf(TEXT("%s %d\n"), *Revision, Changelist);
+
+	// Append, and only rewrite the file to drop the oldest entries once it gets too large
+	// The map keeps insertion order as long as nothing is removed from it, which is the order of the file
+	constexpr int32 MaxEntries = 10000;
+	if (Cache.Num() <= MaxEntries)
+	{
+		if (!FFileHelper::SaveStringToFile(Line, *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append))
+		{
+			LOG_FATAL("Failed to append to %s", *Path);
+		}
+		return;
+	}
+
+	TArray<TPair<FString, int32>> Entries = Cache.Array();
+	Entries.RemoveAt(0, Entries.Num() - MaxEntries / 2);
+
+	Cache.Reset();
+	FString Text;
+	for (const TPair<FString, int32>& Entry : Entries)
+	{
+		Cache.Add(Entry.Key, Entry.Value);
+		Text += FString::Printf(TEXT("%s %d\n"), *Entry.Key, Entry.Value);
+	}
+
+	SaveTextFile(Path, Text);
+}
+
+TOptional<int32> Git_TryGetChangelist_Native(
+	const FString& WorkingDirectory,
+	const FString& Revision)
+{
+	const TOptional<FGitDirectories> Directories = Git_FindDirectories(WorkingDirectory);
+	if (!Directories ||
+		!Git_IsObjectId(Revision))
+	{
+		return {};
+	}
+
+	const TUniquePtr<FGitCommitGraph> Graph = FGitCommitGraph::Load(Directories->CommonDir / "objects");
+	if (!Graph)
+	{
+		return {};
+	}
+
+	uint8 Id[20];
+	check(HexToBytes(Revision, Id) == 20);
+
+	// Commits made since the commit-graph was last written are not in it
+	const TOptional<int32> Head = Graph->Find(Id);
+	if (!Head)
+	{
+		return {};
+	}
+
+	// Look for a cached ancestor along the first parent chain, so that only the new commits are walked
+	{
+		FScopeLock Lock(&GForgeChangelistCacheCriticalSection);
+		const TMap<FString, int32>& Cache = GetChangelistCache();
+
+		int32 Position = Head.GetValue();
+		for (int32 Depth = 0; Depth < 10000 && Cache.Num() > 0; Depth++)
+		{
+			if (const int32* CachedChangelist = Cache.Find(Graph->GetId(Position)))
+			{
+				if (const TOptional<int32> NewCommits = Git_CountAncestorsSince(*Graph, Head.GetValue(), Position))
+				{
+					return *CachedChangelist + NewCommits.GetValue();
+				}
+				break;
+			}
+
+			int32 FirstParent = -1;
+			Graph->ForeachParent(Position, [&](const int32 Parent)
+			{
+				if (FirstParent == -1)
+				{
+					FirstParent = Parent;
+				}
+			});
+
+			if (FirstParent == -1)
+			{
+				break;
+			}
+			Position = FirstParent;
+		}
+	}
+
+	return Git_CountAncestors(*Graph, Head.GetValue());
+}
+
+FString Git_GetRevision()
+{
+	if (const TOptional<FString> Revision = Git_TryGetRevision_Native(GetWorkingDirectory()))
+	{
+		return *Revision;
+	}
+
+	// Not cached: HEAD can be moved by anything, eg git -C, a worktree or a script
+	FExecParams Params;
+	Params.CommandLine = "git rev-parse HEAD";
+	Params.bIsReadOnly = true;
+
+	FString Output;
+	int32 ReturnCode = 0;
+	check(ExecImpl(Params, Output, ReturnCode));
+	return Output;
+}
+
+FString Git_GetShortRevision()
+{
+	const FString Revision = Git_GetRevision();
+
+	const int32 Length = INLINE_LAMBDA
+	{
+		if (const TOptional<int32> NativeLength = Git_TryGetUniquePrefixLength_Native(GetWorkingDirectory(), Revision))
+		{
+			return NativeLength.GetValue();
+		}
+
+		const FString ShortRevision = Exec_Cached("git rev-parse --short=4 " + Revision, Revision);
+		check(Revision.StartsWith(ShortRevision));
+		return ShortRevision.Len();
+	};
+
+	if (Length > 9)
+	{
+		// We have a collision
+		LOG_FATAL("Short revision is too long: %s", *Revision.Left(Length));
+	}
+
+	return Revision.Left(9);
+}
+
+int32 Git_GetChangelist()
+{
+	const FString Revision = Git_GetRevision();
+
+	{
+		FScopeLock Lock(&GForgeChangelistCacheCriticalSection);
+
+		if (const int32* Changelist = GetChangelistCache().Find(Revision))
+		{
+			return *Changelist;
+		}
+	}
+
+	const int32 Changelist = INLINE_LAMBDA
+	{
+		if (const TOptional<int32> NativeChangelist = Git_TryGetChangelist_Native(GetWorkingDirectory(), Revision))
+		{
+			return NativeChangelist.GetValue();
+		}
+
+		return StringToInt(Exec_Cached("git rev-list --count " + Revision, Revision));
+	};
+
+	FScopeLock Lock(&GForgeChangelistCacheCriticalSection);
+	AddToChangelistCache(Revision, Changelist);
+
+	return Changelist;
+}
+
+bool Git_ResetIfDirty()
+{
+	// git status refreshes the index stat cache, so this is much cheaper than always resetting
+	// Untracked files are listed unless ignored, exactly what clean -df would delete
+	if (Exec("git status --porcelain --untracked-files=normal").TrimStartAndEnd().IsEmpty())
+	{
+		return false;
+	}
+
+	Exec("git reset --hard");
+	Exec("git clean -df");
+	return true;
+}
+
+// Remote of the current branch, or the only remote, or origin
+FString Git_GetDefaultRemote()
+{
+	FString Branch;
+	FString Remote;
+	if (TryExec("git symbolic-ref --short --quiet HEAD", Branch) &&
+		TryExec("git config --get branch." + Branch.TrimStartAndEnd() + ".remote", Remote) &&
+		!Remote.TrimStartAndEnd().IsEmpty() &&
+		Remote.TrimStartAndEnd() != ".")
+	{
+		return Remote.TrimStartAndEnd();
+	}
+
+	TArray<FString> Remotes;
+	Exec("git remote").ParseIntoArrayLines(Remotes);
+
+	if (Remotes.Num() == 1)
+	{
+		return Remotes[0].TrimStartAndEnd();
+	}
+
+	return "origin";
+}
+
+// Ref name -> revision
+TMap<FString, FString> Git_GetRemoteRefs(const FString& Remote)
+{
+	TMap<FString, FString> Result;
+
+	TArray<FString> Lines;
+	Exec("git for-each-ref --format=\"%(objectname) %(refname)\" refs/remotes/" + Remote + " refs/tags").ParseIntoArrayLines(Lines);
+
+	for (const FString& Line : Lines)
+	{
+		FString Revision;
+		FString Name;
+		if (Line.Split(" ", &Revision, &Name))
+		{
+			Result.Add(Name, Revision);
+		}
+	}
+	return Result;
+}
+
+FGitFetchResult Git_Fetch(const FString& InRemote)
+{
+	const FString Remote = InRemote.IsEmpty() ? Git_GetDefaultRemote() : InRemote;
+
+	FGitFetchResult Result;
+	Result.OldHead = Git_GetRevision();
+
+	Result.bCleanedWorkingTree = Git_ResetIfDirty();
+
+	const TMap<FString, FString> OldRefs = Git_GetRemoteRefs(Remote);
+
+	// Tags fetched through --tags are not subject to --prune, only the remote-tracking branches are pruned
+	// Local tags that are not on the remote are kept, like a plain fetch --tags
+	Exec("git fetch --prune --tags --force " + Remote + " \"+refs/heads/*:refs/remotes/" + Remote + "/*\"");
+
+	const TMap<FString, FString> NewRefs = Git_GetRemoteRefs(Remote);
+
+	for (const auto& It : NewRefs)
+	{
+		const FString* OldRevision = OldRefs.Find(It.Key);
+		if (!OldRevision ||
+			*OldRevision != It.Value)
+		{
+			Result.UpdatedRefs.Add({ It.Key, OldRevision ? *OldRevision : FString(), It.Value });
+		}
+	}
+	for (const auto& It : OldRefs)
+	{
+		if (!NewRefs.Contains(It.Key))
+		{
+			Result.UpdatedRefs.Add({ It.Key, It.Value, {} });
+		}
+	}
+
+	// Detached HEADs have no upstream
+	FString Upstream;
+	if (TryExec("git rev-parse --verify --quiet @{upstream}", Upstream) &&
+		Upstream != Result.OldHead)
+	{
+		TryExec("git merge --no-edit @{upstream}");
+	}
+
+	Result.NewHead = Git_GetRevision();
+
+	LOG("Git_Fetch: %d refs updated, HEAD %s -> %s%s",
+		Result.UpdatedRefs.Num(),
+		*Result.OldHead.Left(9),
+		*Result.NewHead.Left(9),
+		Result.bCleanedWorkingTree ? TEXT(", working tree cleaned") : TEXT(""));
+
+	return Result;
+}
+
+FCriticalSection GForgeGitMirrorCriticalSection;
+// Mirror path + branch
+TSet<FString> GForgeGitMirrorFetchedBranches;
+
+FString Git_GetMirror(const FString& Url)
+{
+	FString Name = FPaths::GetBaseFilename(Url.TrimStartAndEnd().TrimChar(TEXT('/')));
+	Name = FPaths::MakeValidFileName(Name, TEXT('_'));
+
+	const FString MirrorPath = GetRootDirectory() / "GitMirrors" / FString::Printf(TEXT("%s-%08x.git"), *Name, FCrc::StrCrc32(*Url));
+
+	FScopeLock Lock(&GForgeGitMirrorCriticalSection);
+
+	if (DirectoryExists(MirrorPath / "objects"))
+	{
+		return MirrorPath;
+	}
+
+	LOG_SCOPE("Create git mirror %s", *MirrorPath);
+
+	MakeDirectory(MirrorPath);
+
+	const FString WorkingDirectory = GetWorkingDirectory();
+	ON_SCOPE_EXIT
+	{
+		SetWorkingDirectory(WorkingDirectory);
+	};
+	SetWorkingDirectory(MirrorPath);
+
+	Exec("git init --bare");
+	Exec("git remote add origin \"" + Url + "\"");
+	// Clones reference objects that might become unreachable here: never prune them
+	Exec("git config gc.pruneExpire never");
+	Exec("git config gc.reflogExpireUnreachable never");
+
+	return MirrorPath;
+}
+
+void Git_FetchThroughMirror(const FString& Branch)
+{
+	const TOptional<FGitDirectories> Directories = Git_FindDirectories(GetWorkingDirectory());
+	if (!Directories)
+	{
+		LOG_FATAL("Git_FetchThroughMirror: %s is not a git repository", *GetWorkingDirectory());
+	}
+
+	const FString ClonePath = FPaths::ConvertRelativePathToFull(GetWorkingDirectory());
+	const FString Url = Exec("git config --get remote.origin.url");
+	const FString MirrorPath = Git_GetMirror(Url);
+	const FString MirrorObjects = FPaths::ConvertRelativePathToFull(MirrorPath / "objects");
+
+	{
+		FScopeLock Lock(&GForgeGitMirrorCriticalSection);
+
+		const FString Key = MirrorPath + "\n" + Branch;
+		if (!GForgeGitMirrorFetchedBranches.Contains(Key))
+		{
+			LOG_SCOPE("Update git mirror %s", *Branch);
+
+			const FString WorkingDirectory = GetWorkingDirectory();
+			ON_SCOPE_EXIT
+			{
+				SetWorkingDirectory(WorkingDirectory);
+			};
+			SetWorkingDirectory(MirrorPath);
+
+			// The clone already has most of the history: seed the mirror from it so that only the delta comes from origin
+			if (!TryExec("git rev-parse --verify --quiet refs/heads/" + Branch))
+			{
+				const FString SeedRefspec = "+refs/remotes/origin/" + Branch + ":refs/heads/" + Branch;
+				if (!TryExec("git fetch \"" + ClonePath + "\" \"" + SeedRefspec + "\""))
+				{
+					LOG("%s has no origin/%s, fetching all of it from origin", *ClonePath, *Branch);
+				}
+			}
+
+			Exec("git fetch --force origin \"+refs/heads/" + Branch + ":refs/heads/" + Branch + "\"");
+
+			GForgeGitMirrorFetchedBranches.Add(Key);
+		}
+	}
+
+	const FString AlternatesPath = Directories->CommonDir / "objects" / "info" / "alternates";
+
+	TArray<FString> Alternates;
+	if (FileExists(AlternatesPath))
+	{
+		LoadTextFile(AlternatesPath).ParseIntoArrayLines(Alternates);
+	}
+
+	if (!Alternates.Contains(MirrorObjects))
+	{
+		LOG_SCOPE("Borrow objects from %s", *MirrorPath);
+
+		Alternates.Add(MirrorObjects);
+		SaveTextFile(AlternatesPath, FString::Join(Alternates, TEXT("\n")) + "\n");
+
+		// Existing local objects are kept: dropping the ones the mirror provides means rewriting every pack,
+		// which is left to a manual git repack -a -d -l
+	}
+
+	// All the objects are already reachable through the alternate: only refs are transferred
+	Exec("git fetch \"" + FPaths::ConvertRelativePathToFull(MirrorPath) + "\" " + Branch);
+}
+
+FGitWorktreePool::FGitWorktreePool(
+	const FString& RepositoryPath,
+	const int32 MaxWorktrees)
+	: RepositoryPath(FPaths::ConvertRelativePathToFull(RepositoryPath))
+	, RootPath(INLINE_LAMBDA
+	{
+		const FString FullPath = FPaths::ConvertRelativePathToFull(RepositoryPath);
+		return GetRootDirectory() / "Worktrees" / FString::Printf(TEXT("%s-%08x"),
+			*FPaths::MakeValidFileName(FPaths::GetCleanFilename(FullPath), TEXT('_')),
+			FCrc::StrCrc32(*FullPath));
+	})
+	, MaxWorktrees(MaxWorktrees)
+{
+	check(MaxWorktrees > 0);
+
+	if (!Git_FindDirectories(this->RepositoryPath))
+	{
+		LOG_FATAL("FGitWorktreePool: %s is not a git repository", *this->RepositoryPath);
+	}
+
+	ReleasedEvent = FPlatformProcess::GetSynchEventFromPool();
+
+	const FScopedWorkingDirectory ScopedWorkingDirectory(this->RepositoryPath);
+
+	// Forget worktrees whose directory was deleted
+	Exec("git worktree prune");
+
+	// Worktrees left by previous runs are reused as is
+	for (int32 Index = 0; Index < MaxWorktrees; Index++)
+	{
+		const FString Path = RootPath / FString::FromInt(Index);
+
+		// Worktrees have a .git file pointing to the repository
+		if (!FileExists(Path / ".git"))
+		{
+			continue;
+		}
+
+		if (const TOptional<FString> Revision = Git_TryGetRevision_Native(Path))
+		{
+			FreeWorktrees.Add(Path, Revision.GetValue());
+		}
+	}
+}
+
+FGitWorktreePool::~FGitWorktreePool()
+{
+	check(NumLeased == 0);
+
+	FPlatformProcess::ReturnSynchEventToPool(ReleasedEvent);
+}
+
+FString FGitWorktreePool::Acquire(const FString& InRevision)
+{
+	// Pooled worktrees are keyed by full commit hash, resolve branches, tags and short hashes first
+	const FString Revision = INLINE_LAMBDA
+	{
+		const FScopedWorkingDirectory ScopedWorkingDirectory(RepositoryPath);
+		return Exec("git rev-parse --verify \"" + InRevision + "^{commit}\"").TrimStartAndEnd().ToLower();
+	};
+	check(Git_IsObjectId(Revision));
+
+	FString Path;
+	FString CurrentRevision;
+
+	while (true)
+	{
+		FScopeLock Lock(&CriticalSection);
+
+		// Prefer a worktree already at Revision, then any free one, then a new one
+		for (const auto& It : FreeWorktrees)
+		{
+			if (Path.IsEmpty() ||
+				It.Value == Revision)
+			{
+				Path = It.Key;
+				CurrentRevision = It.Value;
+			}
+		}
+
+		if (!Path.IsEmpty())
+		{
+			FreeWorktrees.Remove(Path);
+			break;
+		}
+
+		if (NumLeased + FreeWorktrees.Num() < MaxWorktrees)
+		{
+			for (int32 Index = 0; ; Index++)
+			{
+				const FString NewPath = RootPath / FString::FromInt(Index);
+				if (!LeasedWorktrees.Contains(NewPath) &&
+					!FreeWorktrees.Contains(NewPath))
+				{
+					Path = NewPath;
+					break;
+				}
+			}
+			break;
+		}
+
+		Lock.Unlock();
+		ReleasedEvent->Wait();
+	}
+
+	{
+		FScopeLock Lock(&CriticalSection);
+		LeasedWorktrees.Add(Path);
+		NumLeased++;
+	}
+
+	if (CurrentRevision.IsEmpty())
+	{
+		LOG("Creating worktree %s at %s (%s)", *Path, *Revision.Left(9), *InRevision);
+
+		const FScopedWorkingDirectory ScopedWorkingDirectory(RepositoryPath);
+
+		if (DirectoryExists(Path))
+		{
+			// Not a valid worktree anymore
+			DeleteDirectory(Path);
+		}
+		MakeDirectory(FPaths::GetPath(Path));
+
+		Exec("git worktree add --force --detach \"" + Path + "\" " + Revision);
+		return Path;
+	}
+
+	LOG("Recycling worktree %s: %s -> %s (%s)", *Path, *CurrentRevision.Left(9), *Revision.Left(9), *InRevision);
+
+	const FScopedWorkingDirectory ScopedWorkingDirectory(Path);
+
+	// Only rewrites files that differ between the two revisions
+	Git_ResetIfDirty();
+
+	if (CurrentRevision != Revision)
+	{
+		Exec("git checkout --force --detach " + Revision);
+	}
+
+	return Path;
+}
+
+void FGitWorktreePool::Release(const FString& Path)
+{
+	const TOptional<FString> Revision = Git_TryGetRevision_Native(Path);
+
+	FScopeLock Lock(&CriticalSection);
+
+	check(LeasedWorktrees.Remove(Path) == 1);
+	NumLeased--;
+
+	if (Revision)
+	{
+		FreeWorktrees.Add(Path, Revision.GetValue());
+	}
+
+	ReleasedEvent->Trigger();
+}
+
+FGitWorktreePool::FLease::FLease(
+	FGitWorktreePool& Pool,
+	const FString& Revision)
+	: Pool(Pool)
+	, Path(Pool.Acquire(Revision))
+	, ScopedWorkingDirectory(Path)
+{
+}
+
+FGitWorktreePool::FLease::~FLease()
+{
+	Pool.Release(Path);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+bool HasCommandLineSwitch(const FString& Name)
+{
+	check(!Name.Contains("-"));
+	check(!Name.Contains("="));
+
+	return FParse::Param(*GForgeArgs, *Name);
+}
+
+FString GetCommandLineValue(const FString& Name)
+{
+	check(!Name.Contains("-"));
+	check(!Name.Contains("="));
+
+	FString Value;
+	if (!FParse::Value(*GForgeArgs, *("-" + Name + "="), Value, false) ||
+		Value.IsEmpty())
+	{
+		LOG_FATAL("Missing commandline argument: %s", *Name);
+	}
+	return Value;
+}
+
+bool GetCommandLineBool(const FString& Name)
+{
+	const FString Value = GetCommandLineValue(Name);
+
+	if (Value != "false" &&
+		Value != "true")
+	{
+		LOG_FATAL("Invalid command line value for %s: %s", *Name, *Value);
+	}
+
+	return Value == "true";
+}
+
+TArray<FString> GetCommandLineArray(const FString& Name)
+{
+	const FString Value = GetCommandLineValue(Name);
+
+	TArray<FString> Array;
+	Value.ParseIntoArray(Array, TEXT(","));
+	check(Array.Num() > 0);
+
+	return Array;
+}
+
+TOptional<FString> TryGetCommandLineValue(const FString& Name)
+{
+	check(!Name.Contains("-"));
+	check(!Name.Contains("="));
+
+	FString Value;
+	if (!FParse::Value(*GForgeArgs, *("-" + Name + "="), Value, false) ||
+		Value.IsEmpty())
+	{
+		return {};
+	}
+	return Value;
+}
+
+FString GetServerToken()
+{
+	const FString ServerToken = FPlatformMisc::GetEnvironmentVariable(TEXT("SERVER_TOKEN"));
+
+	if (ServerToken.IsEmpty())
+	{
+		LOG_FATAL("SERVER_TOKEN is empty");
+	}
+
+	return ServerToken;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FUnrealVersion GetCommandLineUnrealVersion()
+{
+	static const FUnrealVersion StaticUnrealVersion = INLINE_LAMBDA
+	{
+		const FString UnrealVersionString = GetCommandLineValue("UnrealVersion");
+
+		TArray<FString> MajorMinor;
+		UnrealVersionString.ParseIntoArray(MajorMinor, TEXT("."));
+
+		if (MajorMinor.Num() != 2)
+		{
+			LOG_FATAL("Invalid UnrealVersion %s: should be X.X, eg 5.4", *UnrealVersionString);
+		}
+
+		FUnrealVersion UnrealVersion;
+		UnrealVersion.Major = StringToInt(MajorMinor[0]);
+		UnrealVersion.Minor = StringToInt(MajorMinor[1]);
+
+		LOG("Unreal Version: %s", *UnrealVersion.ToString());
+
+		return UnrealVersion;
+	};
+
+	return StaticUnrealVersion;
+}
+
+FString GetLinuxToolchainPath(const FUnrealVersion& UnrealVersion)
+{
+	FString Path;
+
+	if (UnrealVersion.ToString() == "5.4")
+	{
+		Path = "C:/UnrealToolchains/v22_clang-16.0.6-centos7/";
+	}
+	else if (UnrealVersion.ToString() == "5.5")
+	{
+		Path = "C:/UnrealToolchains/v23_clang-18.1.0-rockylinux8/";
+	}
+	else if (UnrealVersion.ToString() == "5.6")
+	{
+		Path = "C:/UnrealToolchains/v25_clang-18.1.0-rockylinux8/";
+	}
+	else if (UnrealVersion.ToString() == "5.7")
+	{
+		Path = "C:/UnrealToolchains/v26_clang-20.1.8-rockylinux8/";
+	}
+	else
+	{
+		LOG_FATAL("Unsupported version: %s, need to update SetupLinuxToolchainFor", *UnrealVersion.ToString());
+	}
+
+	if (!DirectoryExists(Path))
+	{
+		LOG_FATAL("Missing Linux toolchain: %s", *Path);
+	}
+
+	return Path;
+}
+
+// ccache executable, empty if compiler caching is disabled
+// Set with -CompilerCache=<path to ccache>, or found in PATH
+FString GetCompilerCachePath()
+{
+	static const FString Path = INLINE_LAMBDA -> FString
+	{
+		if (HasCommandLineSwitch("NoCompilerCache"))
+		{
+			return {};
+		}
+
+		if (const TOptional<FString> Value = TryGetCommandLineValue("CompilerCache"))
+		{
+			if (!FileExists(Value.GetValue()))
+			{
+				LOG_FATAL("CompilerCache: %s does not exist", **Value);
+			}
+			return Value.GetValue();
+		}
+
+		FString Output;
+		if (!TryExec(IsWindows() ? "where ccache" : "which ccache", Output))
+		{
+			LOG("ccache not found, compiler caching disabled");
+			return {};
+		}
+
+		TArray<FString> Lines;
+		Output.ParseIntoArrayLines(Lines);
+		return Lines.Num() > 0 ? Lines[0].TrimStartAndEnd() : FString();
+	};
+	return Path;
+}
+
+// Environment ccache needs, the local cache lives under GetRootDirectory()
+// A shared cache can be added with -CompilerCacheShared=<directory>, eg a network drive
+TMap<FString, FString> GetCompilerCacheEnvironment()
+{
+	TMap<FString, FString> Environment;
+	Environment.Add("CCACHE_DIR", GetRootDirectory() / "CompilerCache" / "Local");
+	// UBT builds with PCHs and response files
+	Environment.Add("CCACHE_SLOPPINESS", "pch_defines,time_macros,include_file_mtime,include_file_ctime");
+	// Lets checkouts in different directories share entries
+	Environment.Add("CCACHE_BASEDIR", GetRootDirectory());
+
+	if (const TOptional<FString> SharedDirectory = TryGetCommandLineValue("CompilerCacheShared"))
+	{
+		Environment.Add("CCACHE_REMOTE_STORAGE", "file:" + SharedDirectory.GetValue());
+	}
+	return Environment;
+}
+
+// Copy of the toolchain where clang and clang++ are ccache in masquerade mode
+// Everything else is linked to the real toolchain, so this is cheap to create
+FString GetCompilerCacheToolchainPath(const FString& ToolchainPath)
+{
+	FString NormalizedToolchainPath = ToolchainPath;
+	FPaths::NormalizeDirectoryName(NormalizedToolchainPath);
+
+	// The toolchains are only used to cross-compile from Windows
+	check(IsWindows());
+
+	const FString CachePath = GetCompilerCachePath();
+	const FString ShimPath = GetRootDirectory() / "CompilerCache" / "Toolchains" / FPaths::GetCleanFilename(NormalizedToolchainPath);
+	const FString MarkerPath = ShimPath / "ForgeCompilerCache.txt";
+
+	static FCriticalSection CriticalSection;
+	FScopeLock Lock(&CriticalSection);
+
+	if (FileExists(MarkerPath) &&
+		LoadTextFile(MarkerPath) == CachePath + "\n" + NormalizedToolchainPath)
+	{
+		return ShimPath;
+	}
+
+	LOG_SCOPE("Create compiler cache toolchain %s", *ShimPath);
+
+	if (DirectoryExists(ShimPath))
+	{
+		DeleteDirectory(ShimPath);
+	}
+	MakeDirectory(ShimPath);
+
+	// Junctions and hard links don't need admin rights
+	const auto Link = [](const FString& Target, const FString& LinkPath, const bool bIsDirectory)
+	{
+		Exec(FString::Printf(TEXT("mklink %s \"%s\" \"%s\""),
+			bIsDirectory ? TEXT("/J") : TEXT("/H"),
+			*LinkPath.Replace(TEXT("/"), TEXT("\\")),
+			*Target.Replace(TEXT("/"), TEXT("\\"))));
+	};
+
+	for (const FString& Name : ListChildren_FileNames(NormalizedToolchainPath))
+	{
+		CopyFile(NormalizedToolchainPath / Name, ShimPath / Name);
+	}
+
+	// Each architecture has its own bin directory, eg x86_64-unknown-linux-gnu/bin
+	for (const FString& Architecture : ListChildren_DirectoryNames(NormalizedToolchainPath))
+	{
+		const FString ArchitecturePath = NormalizedToolchainPath / Architecture;
+		if (!DirectoryExists(ArchitecturePath / "bin"))
+		{
+			Link(ArchitecturePath, ShimPath / Architecture, true);
+			continue;
+		}
+
+		MakeDirectory(ShimPath / Architecture / "bin");
+
+		for (const FString& Name : ListChildren_DirectoryNames(ArchitecturePath))
+		{
+			if (Name != "bin")
+			{
+				Link(ArchitecturePath / Name, ShimPath / Architecture / Name, true);
+			}
+		}
+		for (const FString& Name : ListChildren_FileNames(ArchitecturePath))
+		{
+			Link(ArchitecturePath / Name, ShimPath / Architecture / Name, false);
+		}
+
+		for (const FString& Name : ListChildren_FileNames(ArchitecturePath / "bin"))
+		{
+			const FString BaseName = FPaths::GetBaseFilename(Name);
+			if (BaseName == "clang" ||
+				BaseName == "clang++")
+			{
+				CopyFile(CachePath, ShimPath / Architecture / "bin" / Name);
+			}
+			else
+			{
+				Link(ArchitecturePath / "bin" / Name, ShimPath / Architecture / "bin" / Name, false);
+			}
+		}
+	}
+
+	SaveTextFile(MarkerPath, CachePath + "\n" + NormalizedToolchainPath);
+	return ShimPath;
+}
+
+// Set once a toolchain was set up with the compiler cache, so that RunUAT reports its stats
+std::atomic<bool> GForgeUsesCompilerCache = false;
+
+TMap<FString, FString> GetLinuxToolchainEnvironment(
+	const FUnrealVersion& UnrealVersion,
+	const FString& Platform)
+{
+	const FString ToolchainPath = GetLinuxToolchainPath(UnrealVersion);
+
+	TMap<FString, FString> Environment;
+	if (GetCompilerCachePath().IsEmpty())
+	{
+		Environment.Add("LINUX_MULTIARCH_ROOT", ToolchainPath);
+		return Environment;
+	}
+
+	Environment = GetCompilerCacheEnvironment();
+	Environment.Add("LINUX_MULTIARCH_ROOT", GetCompilerCacheToolchainPath(ToolchainPath));
+	GForgeUsesCompilerCache = true;
+
+	// In masquerade mode ccache runs the first compiler with the same name in PATH that isn't itself
+	// Only the target architecture is added, to the PATH the process started with
+	static const FString OriginalPath = FPlatformMisc::GetEnvironmentVariable(TEXT("PATH"));
+
+	const FString Architecture = Platform == "LinuxArm64" ? "aarch64-unknown-linux-gnueabi" : "x86_64-unknown-linux-gnu";
+	if (!DirectoryExists(ToolchainPath / Architecture / "bin"))
+	{
+		LOG_FATAL("Missing %s in the Linux toolchain %s", *Architecture, *ToolchainPath);
+	}
+
+	Environment.Add("PATH", ToolchainPath / Architecture / "bin" + (IsWindows() ? ";" : ":") + OriginalPath);
+
+	return Environment;
+}
+
+// Stats are best effort: a failure here must never fail a build that succeeded
+bool TryExecCompilerCache(
+	const FString& Arguments,
+	FString& Output)
+{
+	FExecParams Params;
+	Params.CommandLine = "\"" + GetCompilerCachePath() + "\" " + Arguments;
+	Params.Environment.Append(GetCompilerCacheEnvironment());
+	Params.bAllowFailure = true;
+
+	int32 ReturnCode = 0;
+	return ExecImpl(Params, Output, ReturnCode);
+}
+
+// --print-stats was added in ccache 4.7
+bool CompilerCacheHasPrintStats()
+{
+	static const bool bHasPrintStats = INLINE_LAMBDA
+	{
+		// ccache version 4.9.1
+		FString Output;
+		if (!TryExecCompilerCache("--version", Output))
+		{
+			return false;
+		}
+
+		TArray<FString> Lines;
+		Output.ParseIntoArrayLines(Lines);
+
+		FString Version;
+		if (Lines.Num() == 0 ||
+			!Lines[0].Split("version ", nullptr, &Version))
+		{
+			return false;
+		}
+
+		TArray<FString> Parts;
+		Version.TrimStartAndEnd().ParseIntoArray(Parts, TEXT("."));
+
+		int32 Major = 0;
+		int32 Minor = 0;
+		if (Parts.Num() < 2 ||
+			!LexTryParseString(Major, *Parts[0]) ||
+			!LexTryParseString(Minor, *Parts[1]))
+		{
+			return false;
+		}
+
+		if (Major < 4 ||
+			(Major == 4 && Minor < 7))
+		{
+			LOG("ccache %s is too old to report stats, 4.7 is needed", *Version.TrimStartAndEnd());
+			return false;
+		}
+		return true;
+	};
+	return bHasPrintStats;
+}
+
+void ResetCompilerCacheStats()
+{
+	if (!GForgeUsesCompilerCache)
+	{
+		return;
+	}
+
+	FString Output;
+	if (!TryExecCompilerCache("--zero-stats", Output))
+	{
+		LOG("Failed to reset the compiler cache stats");
+	}
+}
+
+void LogCompilerCacheStats()
+{
+	if (!GForgeUsesCompilerCache ||
+		!CompilerCacheHasPrintStats())
+	{
+		return;
+	}
+
+	// One "name<tab>value" per line
+	TMap<FString, int64> Stats;
+	{
+		FString Output;
+		if (!TryExecCompilerCache("--print-stats", Output))
+		{
+			LOG("Failed to get the compiler cache stats");
+			return;
+		}
+
+		TArray<FString> Lines;
+		Output.ParseIntoArrayLines(Lines);
+
+		for (const FString& Line : Lines)
+		{
+			FString Name;
+			FString Value;
+			int64 Number = 0;
+			if (Line.Split("\t", &Name, &Value) &&
+				IsDigits(Value.TrimStartAndEnd()) &&
+				LexTryParseString(Number, *Value.TrimStartAndEnd()))
+			{
+				Stats.Add(Name.TrimStartAndEnd(), Number);
+			}
+		}
+	}
+
+	const int64 Hits = Stats.FindRef("direct_cache_hit") + Stats.FindRef("preprocessed_cache_hit");
+	const int64 Misses = Stats.FindRef("cache_miss");
+	const int64 RemoteHits = Stats.FindRef("remote_storage_hit");
+
+	LOG("Compiler cache: %lld hits (%lld from the shared cache), %lld misses, %.1f%% hit rate",
+		Hits,
+		RemoteHits,
+		Misses,
+		Hits + Misses > 0 ? 100. * Hits / (Hits + Misses) : 0.);
+
+	LOG("##teamcity[buildStatisticValue key='Forge.CompilerCache.Hits' value='%lld']", Hits);
+	LOG("##teamcity[buildStatisticValue key='Forge.CompilerCache.Misses' value='%lld']", Misses);
+	LOG("##teamcity[buildStatisticValue key='Forge.CompilerCache.RemoteHits' value='%lld']", RemoteHits);
+}
+
+void SetupLinuxToolchainFor(
+	const FUnrealVersion& UnrealVersion,
+	const FString& Platform)
+{
+	// Replaces the previous toolchain instead of stacking on top of it
+	TMap<FString, FString> Environment = GetLinuxToolchainEnvironment(UnrealVersion, Platform);
+
+	FScopeLock Lock(&GForgeExecEnvironmentCriticalSection);
+	GForgeExecEnvironment = MoveTemp(Environment);
+}
+
+// Engines found under the engine directories, scanned once and cached in Saved/ForgeEngines.json
+// Cached entries are only rescanned if the modification time of their directory or Build.version changed
+class FEngineRegistry
+{
+public:
+	static FEngineRegistry& Get()
+	{
+		static FEngineRegistry Registry;
+		return Registry;
+	}
+
+	TOptional<FEngineInfo> Find(
+		const FUnrealVersion& UnrealVersion,
+		const EEngineType EngineType)
+	{
+		FScopeLock Lock(&CriticalSection);
+
+		for (const FString& Directory : GetEngineDirectories())
+		{
+			for (const FString& Prefix : GetEngineNamePrefixes())
+			{
+				const FEntry* Entry = Entries.Find(Directory / Prefix + UnrealVersion.ToString());
+				if (!Entry)
+				{
+					continue;
+				}
+
+				if (EngineType == EEngineType::Source
+					? !Entry->bHasGit
+					: !Entry->bHasBuildVersion)
+				{
+					continue;
+				}
+
+				FEngineInfo Info;
+				Info.Path = Entry->Path;
+				Info.EngineType = EngineType;
+				Info.PatchVersion = Entry->PatchVersion;
+				Info.Changelist = Entry->Changelist;
+				return Info;
+			}
+		}
+		return {};
+	}
+
+	// Called when an engine is not found, it might have been installed since the last scan
+	void Rescan()
+	{
+		FScopeLock Lock(&CriticalSection);
+		Scan(false);
+	}
+
+	FString GetCandidates(const FUnrealVersion& UnrealVersion) const
+	{
+		TArray<FString> Candidates;
+		for (const FString& Directory : GetEngineDirectories())
+		{
+			for (const FString& Prefix : GetEngineNamePrefixes())
+			{
+				Candidates.Add(Directory / Prefix + UnrealVersion.ToString());
+			}
+		}
+		return FString::Join(Candidates, TEXT("\n"));
+	}
+
+private:
+	struct FEntry
+	{
+		FString Path;
+		bool bHasGit = false;
+		bool bHasBuildVersion = false;
+		int32 MajorVersion = 0;
+		int32 MinorVersion = 0;
+		int32 PatchVersion = 0;
+		int32 Changelist = 0;
+		int64 DirectoryTimestamp = 0;
+		int64 BuildVersionTimestamp = 0;
+	};
+
+	FCriticalSection CriticalSection;
+	// Engine path -> entry
+	TMap<FString, FEntry> Entries;
+
+	static const TArray<FString>& GetEngineDirectories()
+	{
+		static const TArray<FString> EngineDirectories =
+			IsWindows()
+			?
+			TArray<FString>
+			{
+				"C:/BUILD",
+				"D:/BUILD",
+				"C:/ROOT",
+				"D:/ROOT",
+				"C:/Program Files/Epic Games/",
+				GetRootDirectory()
+			}
+			:
+			TArray<FString>
+			{
+				"/Users/Shared/",
+				"/Users/Shared/Epic Games/",
+				FString(FPlatformProcess::UserHomeDir()),
+				FString(FPlatformProcess::UserHomeDir()) / "ROOT"
+			};
+
+		return EngineDirectories;
+	}
+	static const TArray<FString>& GetEngineNamePrefixes()
+	{
+		static const TArray<FString> Prefixes =
+		{
+			"UE_",
+			"UnrealEngine-"
+		};
+		return Prefixes;
+	}
+
+	static FString GetCachePath()
+	{
+		return FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) / "ForgeEngines.json";
+	}
+
+	static int64 GetTimestamp(const FString& Path)
+	{
+		return IFileManager::Get().GetTimeStamp(*Path).GetTicks();
+	}
+
+	static FEntry ScanEngine(const FString& Path)
+	{
+		FEntry Entry;
+		Entry.Path = Path;
+		Entry.DirectoryTimestamp = GetTimestamp(Path);
+		Entry.bHasGit = DirectoryExists(Path / ".git");
+
+		const FString BuildVersionPath = Path / "Engine" / "Build" / "Build.version";
+		Entry.bHasBuildVersion = FileExists(BuildVersionPath);
+
+		if (!Entry.bHasBuildVersion)
+		{
+			return Entry;
+		}
+
+		Entry.BuildVersionTimestamp = GetTimestamp(BuildVersionPath);
+
+		TSharedPtr<FJsonObject> BuildVersion;
+		if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(LoadTextFile(BuildVersionPath)), BuildVersion) ||
+			!BuildVersion)
+		{
+			LOG("Invalid %s", *BuildVersionPath);
+			return Entry;
+		}
+
+		Entry.MajorVersion = BuildVersion->GetIntegerField(TEXT("MajorVersion"));
+		Entry.MinorVersion = BuildVersion->GetIntegerField(TEXT("MinorVersion"));
+		Entry.PatchVersion = BuildVersion->GetIntegerField(TEXT("PatchVersion"));
+		Entry.Changelist = BuildVersion->GetIntegerField(TEXT("Changelist"));
+
+		const FString ExpectedSuffix = FString::Printf(TEXT("%d.%d"), Entry.MajorVersion, Entry.MinorVersion);
+		if (!FPaths::GetCleanFilename(Path).EndsWith(ExpectedSuffix))
+		{
+			LOG("%s is actually Unreal %s", *Path, *ExpectedSuffix);
+		}
+
+		return Entry;
+	}
+
+	// Uses the TryGet accessors only: the Get ones log errors on missing fields, which fail the commandlet
+	static bool LoadCache(
+		TMap<FString, int64>& OutDirectories,
+		TMap<FString, FEntry>& OutEntries)
+	{
+		if (!FileExists(GetCachePath()))
+		{
+			return true;
+		}
+
+		const auto TryParseInt64 = [](const FString& Text, int64& OutValue)
+		{
+			return
+				IsDigits(Text) &&
+				Text.Len() <= 18 &&
+				LexTryParseString(OutValue, *Text);
+		};
+
+		TSharedPtr<FJsonObject> Cache;
+		if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(LoadTextFile(GetCachePath())), Cache) ||
+			!Cache)
+		{
+			return false;
+		}
+
+		const TSharedPtr<FJsonObject>* DirectoriesObject = nullptr;
+		const TArray<TSharedPtr<FJsonValue>>* Engines = nullptr;
+		if (!Cache->TryGetObjectField(TEXT("Directories"), DirectoriesObject) ||
+			!Cache->TryGetArrayField(TEXT("Engines"), Engines))
+		{
+			return false;
+		}
+
+		for (const auto& It : (*DirectoriesObject)->Values)
+		{
+			FString TimestampText;
+			int64 Timestamp = 0;
+			if (!It.Value ||
+				!It.Value->TryGetString(TimestampText) ||
+				!TryParseInt64(TimestampText, Timestamp))
+			{
+				return false;
+			}
+			OutDirectories.Add(It.Key, Timestamp);
+		}
+
+		for (const TSharedPtr<FJsonValue>& Value : *Engines)
+		{
+			const TSharedPtr<FJsonObject>* Object = nullptr;
+			if (!Value ||
+				!Value->TryGetObject(Object))
+			{
+				return false;
+			}
+
+			FEntry Entry;
+			FString DirectoryTimestamp;
+			FString BuildVersionTimestamp;
+			if (!(*Object)->TryGetStringField(TEXT("Path"), Entry.Path) ||
+				!(*Object)->TryGetBoolField(TEXT("HasGit"), Entry.bHasGit) ||
+				!(*Object)->TryGetBoolField(TEXT("HasBuildVersion"), Entry.bHasBuildVersion) ||
+				!(*Object)->TryGetNumberField(TEXT("MajorVersion"), Entry.MajorVersion) ||
+				!(*Object)->TryGetNumberField(TEXT("MinorVersion"), Entry.MinorVersion) ||
+				!(*Object)->TryGetNumberField(TEXT("PatchVersion"), Entry.PatchVersion) ||
+				!(*Object)->TryGetNumberField(TEXT("Changelist"), Entry.Changelist) ||
+				!(*Object)->TryGetStringField(TEXT("DirectoryTimestamp"), DirectoryTimestamp) ||
+				!(*Object)->TryGetStringField(TEXT("BuildVersionTimestamp"), BuildVersionTimestamp) ||
+				!TryParseInt64(DirectoryTimestamp, Entry.DirectoryTimestamp) ||
+				!TryParseInt64(BuildVersionTimestamp, Entry.BuildVersionTimestamp))
+			{
+				return false;
+			}
+			OutEntries.Add(Entry.Path, Entry);
+		}
+
+		return true;
+	}
+
+	FEngineRegistry()
+	{
+		FScopeLock Lock(&CriticalSection);
+		Scan(true);
+	}
+
+	void Scan(const bool bUseCache)
+	{
+		LOG_SCOPE("Scan engines");
+
+		Entries.Reset();
+
+		// Engine directory -> timestamp
+		TMap<FString, int64> CachedDirectories;
+		TMap<FString, FEntry> CachedEntries;
+
+		if (bUseCache &&
+			!LoadCache(CachedDirectories, CachedEntries))
+		{
+			LOG("Invalid or outdated %s, rescanning all engines", *GetCachePath());
+			CachedDirectories.Reset();
+			CachedEntries.Reset();
+		}
+
+		bool bChanged = false;
+		TMap<FString, int64> Directories;
+
+		for (const FString& Directory : GetEngineDirectories())
+		{
+			if (!DirectoryExists(Directory))
+			{
+				continue;
+			}
+
+			const int64 Timestamp = GetTimestamp(Directory);
+			Directories.Add(Directory, Timestamp);
+
+			// Engines were added or removed
+			const int64* CachedTimestamp = CachedDirectories.Find(Directory);
+			const bool bRescanDirectory = !CachedTimestamp || *CachedTimestamp != Timestamp;
+
+			TArray<FString> Paths;
+			if (bRescanDirectory)
+			{
+				bChanged = true;
+
+				for (const FString& Name : ListChildren_DirectoryNames(Directory))
+				{
+					for (const FString& Prefix : GetEngineNamePrefixes())
+					{
+						if (Name.StartsWith(Prefix))
+						{
+							Paths.Add(Directory / Name);
+							break;
+						}
+					}
+				}
+			}
+			else
+			{
+				FString NormalizedDirectory = Directory;
+				FPaths::NormalizeDirectoryName(NormalizedDirectory);
+
+				for (const auto& It : CachedEntries)
+				{
+					if (FPaths::GetPath(It.Key) == NormalizedDirectory)
+					{
+						Paths.Add(It.Key);
+					}
+				}
+			}
+
+			for (const FString& Path : Paths)
+			{
+				const FEntry* CachedEntry = CachedEntries.Find(Path);
+				if (CachedEntry &&
+					CachedEntry->DirectoryTimestamp == GetTimestamp(Path) &&
+					CachedEntry->BuildVersionTimestamp == GetTimestamp(Path / "Engine" / "Build" / "Build.version"))
+				{
+					Entries.Add(Path, *CachedEntry);
+					continue;
+				}
+
+				bChanged = true;
+				Entries.Add(Path, ScanEngine(Path));
+			}
+		}
+
+		for (const auto& It : Entries)
+		{
+			LOG("%s: %d.%d.%d CL %d%s",
+				*It.Key,
+				It.Value.MajorVersion,
+				It.Value.MinorVersion,
+				It.Value.PatchVersion,
+				It.Value.Changelist,
+				It.Value.bHasGit ? TEXT(" (source)") : TEXT(""));
+		}
+
+		if (!bChanged)
+		{
+			return;
+		}
+
+		const TSharedRef<FJsonObject> NewCache = MakeShared<FJsonObject>();
+
+		const TSharedRef<FJsonObject> DirectoriesObject = MakeShared<FJsonObject>();
+		for (const auto& It : Directories)
+		{
+			DirectoriesObject->SetStringField(It.Key, LexToString(It.Value));
+		}
+		NewCache->SetObjectField(TEXT("Directories"), DirectoriesObject);
+
+		TArray<TSharedPtr<FJsonValue>> Engines;
+		for (const auto& It : Entries)
+		{
+			const FEntry& Entry = It.Value;
+
+			const TSharedRef<FJsonObject> Object = MakeShared<FJsonObject>();
+			Object->SetStringField(TEXT("Path"), Entry.Path);
+			Object->SetBoolField(TEXT("HasGit"), Entry.bHasGit);
+			Object->SetBoolField(TEXT("HasBuildVersion"), Entry.bHasBuildVersion);
+			Object->SetNumberField(TEXT("MajorVersion"), Entry.MajorVersion);
+			Object->SetNumberField(TEXT("MinorVersion"), Entry.MinorVersion);
+			Object->SetNumberField(TEXT("PatchVersion"), Entry.PatchVersion);
+			Object->SetNumberField(TEXT("Changelist"), Entry.Changelist);
+			// Ticks don't fit in a double
+			Object->SetStringField(TEXT("DirectoryTimestamp"), LexToString(Entry.DirectoryTimestamp));
+			Object->SetStringField(TEXT("BuildVersionTimestamp"), LexToString(Entry.BuildVersionTimestamp));
+			Engines.Add(MakeShared<FJsonValueObject>(Object));
+		}
+		NewCache->SetArrayField(TEXT("Engines"), Engines);
+
+		SaveTextFile(GetCachePath(), JsonToString(NewCache, true));
+	}
+};
+
+FEngineInfo GetEngineInfo(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType)
+{
+	FEngineRegistry& Registry = FEngineRegistry::Get();
+
+	if (const TOptional<FEngineInfo> Info = Registry.Find(UnrealVersion, EngineType))
+	{
+		return Info.GetValue();
+	}
+
+	LOG("Engine for %s not found, rescanning", *UnrealVersion.ToString());
+	Registry.Rescan();
+
+	if (const TOptional<FEngineInfo> Info = Registry.Find(UnrealVersion, EngineType))
+	{
+		return Info.GetValue();
+	}
+
+	LOG_FATAL("Failed to find engine for %s. Looked in \n%s",
+		*UnrealVersion.ToString(),
+		*Registry.GetCandidates(UnrealVersion));
+
+	return {};
+}
+
+FString FindEnginePath(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType)
+{
+	return GetEngineInfo(UnrealVersion, EngineType).Path;
+}
+
+FCriticalSection GForgeEngineUpdatesCriticalSection;
+// Unreal version -> update of its source engine
+TMap<FString, TSharedFuture<void>> GForgeEngineUpdates;
+
+TSharedFuture<void> StartSourceEngineUpdate(
+	const FUnrealVersion& UnrealVersion,
+	const FString& Path)
+{
+	FScopeLock Lock(&GForgeEngineUpdatesCriticalSection);
+
+	if (const TSharedFuture<void>* Update = GForgeEngineUpdates.Find(UnrealVersion.ToString()))
+	{
+		return *Update;
+	}
+
+	LOG("Updating engine %s in the background", *UnrealVersion.ToString());
+
+	TSharedFuture<void> Update = Async(EAsyncExecution::Thread, [UnrealVersion, Path]
+	{
+		const FScopedWorkingDirectory ScopedWorkingDirectory(Path);
+
+		Git_FetchThroughMirror(UnrealVersion.ToString());
+		Exec("git merge FETCH_HEAD");
+
+		LOG("Engine %s updated", *UnrealVersion.ToString());
+	}).Share();
+
+	GForgeEngineUpdates.Add(UnrealVersion.ToString(), Update);
+	return Update;
+}
+
+void PrefetchSourceEngines(const TArray<FUnrealVersion>& UnrealVersions)
+{
+	for (const FUnrealVersion& UnrealVersion : UnrealVersions)
+	{
+		StartSourceEngineUpdate(UnrealVersion, FindEnginePath(UnrealVersion, EEngineType::Source));
+	}
+}
+
+FString GetEnginePath(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType)
+{
+	const FString Path = FindEnginePath(UnrealVersion, EngineType);
+	check(DirectoryExists(Path));
+
+	if (EngineType == EEngineType::Source)
+	{
+		const TSharedFuture<void> Update = StartSourceEngineUpdate(UnrealVersion, Path);
+
+		if (!Update.IsReady())
+		{
+			LOG_SCOPE("Wait for engine %s update", *UnrealVersion.ToString());
+			Update.Wait();
+		}
+	}
+
+	return Path;
+}
+
+FString GetRunUATPathInEngine(const FString& EnginePath)
+{
+	if (IsWindows())
+	{
+		return EnginePath / "Engine/Build/BatchFiles/RunUAT.bat";
+	}
+	else
+	{
+		return EnginePath / "Engine/Build/BatchFiles/RunUAT.sh";
+	}
+}
+
+FString GetRunUATPath(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType)
+{
+	return GetRunUATPathInEngine(GetEnginePath(UnrealVersion, EngineType));
+}
+
+FString RunUAT(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType,
+	const FString& Command)
+{
+	ResetCompilerCacheStats();
+
+	const FString Output = Exec_PostErrors(FString::Printf(
+		TEXT("\"%s\" %s"),
+		*GetRunUATPath(UnrealVersion, EngineType),
+		*Command));
+
+	LogCompilerCacheStats();
+
+	return Output;
+}
+
+FRunUATMatrix::FRun& FRunUATMatrix::Add(
+	const FUnrealVersion& UnrealVersion,
+	const EEngineType EngineType,
+	const FString& Platform,
+	const FString& Command)
+{
+	FRun& Run = Runs.Emplace_GetRef();
+	Run.UnrealVersion = UnrealVersion;
+	Run.EngineType = EngineType;
+	Run.Platform = Platform;
+	Run.Command = Command;
+	return Run;
+}
+
+bool FRunUATMatrix::TryRun()
+{
+	LOG_SCOPE("RunUATMatrix");
+
+	TArray<FUnrealVersion> SourceVersions;
+	for (const FRun& Run : Runs)
+	{
+		if (Run.EngineType == EEngineType::Source)
+		{
+			SourceVersions.Add(Run.UnrealVersion);
+		}
+	}
+	PrefetchSourceEngines(SourceVersions);
+
+	FExecGraph Graph;
+	// Engine path -> last node using it
+	TMap<FString, int32> EngineToLastNode;
+
+	for (FRun& Run : Runs)
+	{
+		const FString Name = Run.UnrealVersion.ToString() + " " + Run.Platform;
+		// Doesn't wait for the source engine update, the node does: runs on engines that are ready start right away
+		const FString EnginePath = FindEnginePath(Run.UnrealVersion, Run.EngineType);
+
+		Run.Directory = GetRootDirectory() / "RunUATMatrix" / Run.UnrealVersion.ToString_NoDot() + "_" + Run.Platform;
+		if (DirectoryExists(Run.Directory))
+		{
+			DeleteDirectory(Run.Directory);
+		}
+		MakeDirectory(Run.Directory);
+
+		// UBT holds a per-engine mutex and writes to the engine intermediate directory: one run per engine at a time
+		TArray<int32> Dependencies;
+		if (const int32* LastNode = EngineToLastNode.Find(EnginePath))
+		{
+			Dependencies.Add(*LastNode);
+		}
+
+		const int32 Node = Graph.Add(
+			Name,
+			FString::Printf(TEXT("\"%s\" %s"),
+				*GetRunUATPathInEngine(EnginePath),
+				*Run.Command.Replace(TEXT("{Directory}"), *Run.Directory)),
+			Dependencies,
+			1,
+			Run.Memory);
+
+		EngineToLastNode.Add(EnginePath, Node);
+
+		// Same error reporting as RunUAT
+		Graph.GetNode(Node).bPostErrors = true;
+
+		if (Run.EngineType == EEngineType::Source)
+		{
+			// Not GetEnginePath: its LOG_SCOPE would open TeamCity blocks from several threads at once
+			Graph.GetNode(Node).OnStart = [UnrealVersion = Run.UnrealVersion, EnginePath, Name]
+			{
+				const TSharedFuture<void> Update = StartSourceEngineUpdate(UnrealVersion, EnginePath);
+				if (!Update.IsReady())
+				{
+					LOG("[%s] waiting for engine %s update", *Name, *UnrealVersion.ToString());
+					Update.Wait();
+				}
+			};
+		}
+
+		TMap<FString, FString>& Environment = Graph.GetNode(Node).Environment;
+		// Otherwise all the runs would write their logs to the same folder
+		Environment.Add("uebp_LogFolder", Run.Directory / "Logs");
+
+		if (IsWindows() &&
+			Run.Platform.StartsWith("Linux"))
+		{
+			Environment.Append(GetLinuxToolchainEnvironment(Run.UnrealVersion, Run.Platform));
+		}
+	}
+
+	ResetCompilerCacheStats();
+
+	// The memory budget is what limits parallel runs, not the cores: UBT already uses them all
+	const bool bSuccess = Graph.TryRun(Runs.Num());
+
+	LogCompilerCacheStats();
+
+	for (int32 Index = 0; Index < Runs.Num(); Index++)
+	{
+		const FExecGraph::FNode& Node = Graph.GetNodes()[Index];
+
+		FRun& Run = Runs[Index];
+		Run.bSuccess = Node.bSuccess;
+		Run.Duration = Node.Duration;
+		Run.Output = Node.Output;
+		Run.Errors = Node.Errors;
+
+		LOG("%s: %s in %s",
+			*Node.Name,
+			Node.bSkipped ? TEXT("skipped") : Node.bSuccess ? TEXT("succeeded") : TEXT("failed"),
+			*SecondsToString(Node.Duration));
+	}
+
+	return bSuccess;
+}
+
+void FRunUATMatrix::Run()
+{
+	if (TryRun())
+	{
+		return;
+	}
+
+	FString Message;
+	for (const FRun& Run : Runs)
+	{
+		if (Run.bSuccess)
+		{
+			continue;
+		}
+
+		Message += "*RunUAT " + Run.UnrealVersion.ToString() + " " + Run.Platform + "*";
+
+		if (Run.Errors.Num() == 0)
+		{
+			Message += "\n";
+			continue;
+		}
+
+		Message += "\n```\n";
+		for (int32 Index = 0; Index < FMath::Min(Run.Errors.Num(), 10); Index++)
+		{
+			Message += Run.Errors[Index] + "\n";
+		}
+		Message += "```\n";
+	}
+
+	PostFatalSlackMessage(Message);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FString FHttpResponse::GetHeader(const FString& Name) const
+{
+	for (const FString& Header : Headers)
+	{
+		FString Key;
+		FString Value;
+		if (Header.Split(":", &Key, &Value) &&
+			Key.TrimStartAndEnd().Equals(Name, ESearchCase::IgnoreCase))
+		{
+			return Value.TrimStartAndEnd();
+		}
+	}
+	return {};
+}
+
+struct FHttpFuture::FState
+{
+	FString Verb;
+	TSet<int32> ValidCodes;
+	TFunction<void(FString)> OnComplete;
+	TSharedPtr<IHttpRequest> Request;
+
+	FEvent* const CompletedEvent = FPlatformProcess::GetSynchEventFromPool(true);
+
+	// False when the body is streamed to a file
+	bool bLogContent = true;
+
+	FCriticalSection CriticalSection;
+	bool bFinished = false;
+	FString Error;
+	FHttpResponse Response;
+
+	~FState()
+	{
+		FPlatformProcess::ReturnSynchEventToPool(CompletedEvent);
+	}
+};
+
+FHttpFuture SendHttpRequest(
+	const TSharedRef<IHttpRequest>& Request,
+	const FString& Verb,
+	const TSet<int32>& ValidCodes,
+	TFunction<void(FString)> OnComplete = nullptr,
+	const bool bLogContent = true)
+{
+	const TSharedRef<FHttpFuture::FState> State = MakeShared<FHttpFuture::FState>();
+	State->Verb = Verb;
+	State->ValidCodes = ValidCodes;
+	State->OnComplete = MoveTemp(OnComplete);
+	State->Request = Request;
+	State->bLogContent = bLogContent;
+
+	// Don't wait for the game thread to tick the manager to be notified
+	Request->SetDelegateThreadPolicy(EHttpRequestDelegateThreadPolicy::CompleteOnHttpThread);
+	Request->OnProcessRequestComplete().BindLambda([WeakState = TWeakPtr<FHttpFuture::FState>(State)](FHttpRequestPtr, FHttpResponsePtr, bool)
+	{
+		if (const TSharedPtr<FHttpFuture::FState> PinnedState = WeakState.Pin())
+		{
+			PinnedState->CompletedEvent->Trigger();
+		}
+	});
+
+	Request->ProcessRequest();
+
+	return FHttpFuture(State);
+}
+
+bool FHttpFuture::IsReady() const
+{
+	check(State);
+	return State->CompletedEvent->Wait(0);
+}
+
+void FHttpFuture::Wait() const
+{
+	while (!WaitFor(1.))
+	{
+	}
+}
+
+bool FHttpFuture::WaitFor(const double Seconds) const
+{
+	check(State);
+
+	const double EndTime = FPlatformTime::Seconds() + Seconds;
+	while (!State->CompletedEvent->Wait(FMath::Clamp(int32((EndTime - FPlatformTime::Seconds()) * 1000), 0, 10)))
+	{
+		if (FPlatformTime::Seconds() >= EndTime)
+		{
+			return false;
+		}
+
+		// Without a dedicated HTTP thread, requests only progress when the manager is ticked
+		if (IsInGameThread())
+		{
+			FHttpModule::Get().GetHttpManager().Tick(0.f);
+		}
+	}
+	return true;
+}
+
+const FHttpResponse& FHttpFuture::Get() const
+{
+	if (const FHttpResponse* Response = TryGet())
+	{
+		return *Response;
+	}
+
+	LOG_FATAL("%s failed: %s", *State->Verb, *State->Error);
+	return State->Response;
+}
+
+const FHttpResponse* FHttpFuture::TryGet() const
+{
+	Wait();
+
+	FScopeLock Lock(&State->CriticalSection);
+
+	if (State->bFinished)
+	{
+		return State->Error.IsEmpty() ? &State->Response : nullptr;
+	}
+	State->bFinished = true;
+
+	// Release the request and its buffers
+	const TSharedPtr<IHttpRequest> Request = MoveTemp(State->Request);
+
+	const TSharedPtr<IHttpResponse> Response = Request->GetResponse();
+	if (!Response ||
+		Request->GetStatus() != EHttpRequestStatus::Succeeded)
+	{
+		State->Error = "Failed to connect";
+		LOG("%s failed: %s", *State->Verb, *State->Error);
+		return nullptr;
+	}
+
+	State->Response.Code = Response->GetResponseCode();
+	State->Response.Content = State->bLogContent ? Response->GetContentAsString() : FString();
+	State->Response.Headers = Response->GetAllHeaders();
+
+	if (!State->ValidCodes.Contains(State->Response.Code))
+	{
+		State->Error = FString::Printf(TEXT("%d\n%s"), State->Response.Code, *State->Response.Content);
+		LOG("%s failed: %s", *State->Verb, *State->Error);
+		return nullptr;
+	}
+
+	if (State->bLogContent)
+	{
+		LOG("RESPONSE: %d\n%s",
+			State->Response.Code,
+			*State->Response.Content);
+	}
+	else
+	{
+		LOG("RESPONSE: %d", State->Response.Code);
+	}
+
+	if (State->OnComplete)
+	{
+		State->OnComplete(State->Response.Content);
+	}
+
+	return &State->Response;
+}
+
+TArray<FHttpResponse> Http_WhenAll(const TConstArrayView<FHttpFuture> Futures)
+{
+	TArray<FHttpResponse> Responses;
+	Responses.Reserve(Futures.Num());
+
+	for (const FHttpFuture& Future : Futures)
+	{
+		Responses.Add(Future.Get());
+	}
+	return Responses;
+}
+
+TArray<FHttpResponse> Http_Batch(
+	const TConstArrayView<TFunction<FHttpFuture()>> Requests,
+	const int32 MaxConcurrency)
+{
+	check(MaxConcurrency >= 1);
+
+	LOG_SCOPE("Http_Batch: %d requests, %d at once", Requests.Num(), MaxConcurrency);
+
+	// Requests reuse the connections the HTTP module keeps alive per host, capping concurrency keeps them few
+	TArray<FHttpFuture> Futures;
+	Futures.SetNum(Requests.Num());
+
+	TArray<FHttpResponse> Responses;
+	Responses.SetNum(Requests.Num());
+
+	TArray<int32> Running;
+	int32 NextRequest = 0;
+
+	while (NextRequest < Requests.Num() ||
+		Running.Num() > 0)
+	{
+		while (NextRequest < Requests.Num() &&
+			Running.Num() < MaxConcurrency)
+		{
+			Futures[NextRequest] = Requests[NextRequest]();
+			check(Futures[NextRequest].IsValid());
+
+			Running.Add(NextRequest);
+			NextRequest++;
+		}
+
+		// Wait for the oldest request, but start new ones as soon as any finished
+		Futures[Running[0]].WaitFor(0.01);
+
+		for (int32 Index = 0; Index < Running.Num(); Index++)
+		{
+			const int32 Request = Running[Index];
+			if (!Futures[Request].IsReady())
+			{
+				continue;
+			}
+
+			Responses[Request] = Futures[Request].Get();
+			Futures[Request] = {};
+
+			Running.RemoveAt(Index);
+			Index--;
+		}
+	}
+
+	return Responses;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+// What If-Range is checked against: a strong ETag, else Last-Modified
+// Weak ETags can't be used with If-Range
+FString GetHttpValidator(
+	const FString& ETag,
+	const FString& LastModified)
+{
+	if (!ETag.IsEmpty() &&
+		!ETag.StartsWith("W/"))
+	{
+		return ETag;
+	}
+	return LastModified;
+}
+
+// Receives a response body on the HTTP thread and appends it to a file as it arrives
+// The validator of the response that starts the file is saved to ValidatorPath, to check later resumes against
+class FHttpFileWriter : public FArchive
+{
+public:
+	FHttpFileWriter(
+		const FString& Path,
+		const FString& ValidatorPath,
+		const TSharedRef<IHttpRequest>& Request,
+		const bool bIsRange,
+		const bool bHash)
+		: Path(Path)
+		, ValidatorPath(ValidatorPath)
+		, WeakRequest(Request)
+		, bIsRange(bIsRange)
+		, bHash(bHash)
+	{
+		SetIsSaving(true);
+
+		Size = FileExists(Path) ? FileSize(Path) : 0;
+
+		if (bHash &&
+			Size > 0)
+		{
+			const TUniquePtr<IFileHandle> ReadHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path));
+			check(ReadHandle);
+
+			TArray<uint8> Buffer;
+			Buffer.SetNumUninitialized(1024 * 1024);
+
+			for (int64 Offset = 0; Offset < Size; Offset += Buffer.Num())
+			{
+				const int64 ChunkSize = FMath::Min<int64>(Buffer.Num(), Size - Offset);
+				check(ReadHandle->Read(Buffer.GetData(), ChunkSize));
+				Sha.Update(Buffer.GetData(), ChunkSize);
+			}
+		}
+
+		Open(true);
+	}
+
+	virtual void Serialize(void* Data, const int64 Length) override
+	{
+		if (!bCheckedResponse)
+		{
+			bCheckedResponse = true;
+
+			const TSharedPtr<IHttpRequest> Request = WeakRequest.Pin();
+			const TSharedPtr<IHttpResponse> Response = Request ? Request->GetResponse() : nullptr;
+			const int32 Code = Response ? Response->GetResponseCode() : 0;
+
+			if (Code == 200 &&
+				bIsRange)
+			{
+				// The file changed since the part file was started, or the server ignored the Range header
+				// Either way the body is the whole file, not the range we want: don't download it
+				bDiscard = true;
+				bNeedsRestart = true;
+				SetError();
+				Request->CancelRequest();
+			}
+			else if (
+				Code == 200 &&
+				Size > 0)
+			{
+				// The file changed since the part file was started, or the server ignored the Range header
+				Size = 0;
+				Sha = FSHA1();
+				Open(false);
+			}
+			else if (
+				Code != 200 &&
+				Code != 206)
+			{
+				// Error page, don't mix it with the data
+				bDiscard = true;
+			}
+
+			if (!bDiscard &&
+				Size == 0)
+			{
+				const FString Validator = GetHttpValidator(Response->GetHeader("ETag"), Response->GetHeader("Last-Modified"));
+				if (!Validator.IsEmpty())
+				{
+					SaveTextFile(ValidatorPath, Validator);
+				}
+				else if (FileExists(ValidatorPath))
+				{
+					DeleteFile(ValidatorPath);
+				}
+			}
+		}
+
+		if (bDiscard)
+		{
+			return;
+		}
+
+		if (!Handle ||
+			!Handle->Write(static_cast<const uint8*>(Data), Length))
+		{
+			SetError();
+			return;
+		}
+
+		Size += Length;
+
+		if (bHash)
+		{
+			Sha.Update(static_cast<const uint8*>(Data), Length);
+		}
+	}
+	virtual int64 Tell() override
+	{
+		return Size;
+	}
+	virtual int64 TotalSize() override
+	{
+		return Size;
+	}
+	virtual FString GetArchiveName() const override
+	{
+		return "FHttpFileWriter";
+	}
+
+	int64 GetSize() const
+	{
+		return Size;
+	}
+	bool NeedsRestart() const
+	{
+		return bNeedsRestart;
+	}
+	FString GetSha1() const
+	{
+		check(bHash);
+
+		FSHA1 FinalSha = Sha;
+		FinalSha.Final();
+
+		FSHAHash Hash;
+		FinalSha.GetHash(Hash.Hash);
+		return Hash.ToString().ToLower();
+	}
+	void Close()
+	{
+		Handle.Reset();
+	}
+
+private:
+	const FString Path;
+	const FString ValidatorPath;
+	const TWeakPtr<IHttpRequest> WeakRequest;
+	const bool bIsRange;
+	const bool bHash;
+
+	TUniquePtr<IFileHandle> Handle;
+	int64 Size = 0;
+	FSHA1 Sha;
+	bool bCheckedResponse = false;
+	bool bDiscard = false;
+	bool bNeedsRestart = false;
+
+	void Open(const bool bAppend)
+	{
+		Handle.Reset();
+		Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, bAppend));
+
+		if (!Handle)
+		{
+			LOG_FATAL("Failed to open %s for writing", *Path);
+		}
+	}
+};
+
+FHttpGet::~FHttpGet()
 {
-	check(!Name.Contains("-"));
-	check(!Name.Contains("="));
+	if (bSent)
+	{
+		return;
+	}
 
-	FString Value;
-	if (!FParse::Value(*GForgeArgs, *("-" + Name + "="), Value, false) ||
-		Value.IsEmpty())
+	if (!PrivateFilePath.IsEmpty())
 	{
-		return {};
+		DownloadToFile();
+		return;
 	}
-	return Value;
+
+	Send().Get();
 }
 
-FString GetServerToken()
+FHttpFuture FHttpGet::Send()
 {
-	const FString ServerToken = FPlatformMisc::GetEnvironmentVariable(TEXT("SERVER_TOKEN"));
+	check(!bSent);
+	check(PrivateFilePath.IsEmpty());
+	bSent = true;
 
-	if (ServerToken.IsEmpty())
+	if (PrivateRangeStart != -1)
 	{
-		LOG_FATAL("SERVER_TOKEN is empty");
+		return SendHttpRequest(CreateRequest(), "GET", { 206 });
 	}
 
-	return ServerToken;
+	return SendHttpRequest(CreateRequest(), "GET", { 200 });
 }
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+void FHttpGet::DownloadToFile()
+{
+	LOG_SCOPE("Download %s", *PrivateFilePath);
 
-FUnrealVersion GetCommandLineUnrealVersion()
+	MakeDirectory(FPaths::GetPath(PrivateFilePath));
+
+	const FString PartPath = PrivateFilePath + ".part";
+	const FString ValidatorPath = PartPath + ".validator";
+	constexpr int32 MaxAttempts = 5;
+
+	const auto DeletePartFiles = [&]
+	{
+		for (const FString& Path : { PartPath, ValidatorPath })
+		{
+			if (FileExists(Path))
+			{
+				DeleteFile(Path);
+			}
+		}
+	};
+
+	// Without a validator we can't tell whether a part file left by a previous run is from the same file
+	// It is then only resumed by the retries below, within this process
+	if (FileExists(PartPath) &&
+		!FileExists(ValidatorPath))
+	{
+		LOG("%s has no validator, not resuming it", *PartPath);
+		DeletePartFiles();
+	}
+
+	for (int32 Attempt = 1; ; Attempt++)
+	{
+		const TSharedRef<IHttpRequest> Request = CreateRequest();
+		const TSharedRef<FHttpFileWriter> Writer = MakeShared<FHttpFileWriter>(
+			PartPath,
+			ValidatorPath,
+			Request,
+			PrivateRangeStart != -1,
+			!PrivateExpectedSha1.IsEmpty());
+
+		// Asking for bytes=<End + 1>-<End> is invalid, servers would answer with the whole file
+		if (PrivateRangeStart != -1 &&
+			Writer->GetSize() == PrivateRangeEnd - PrivateRangeStart + 1)
+		{
+			LOG("%s already has the whole range", *PartPath);
+			Writer->Close();
+
+			if (!PrivateExpectedSha1.IsEmpty() &&
+				!Writer->GetSha1().Equals(PrivateExpectedSha1, ESearchCase::IgnoreCase))
+			{
+				DeletePartFiles();
+				LOG_FATAL("GET %s: expected SHA-1 %s, got %s", *Url, *PrivateExpectedSha1, *Writer->GetSha1());
+			}
+			break;
+		}
+
+		if (Writer->GetSize() > 0)
+		{
+			LOG("Resuming at %s", *BytesToString(Writer->GetSize()));
+
+			if (PrivateRangeStart != -1)
+			{
+				Request->SetHeader("Range", FString::Printf(TEXT("bytes=%lld-%lld"), PrivateRangeStart + Writer->GetSize(), PrivateRangeEnd));
+			}
+			else
+			{
+				Request->SetHeader("Range", FString::Printf(TEXT("bytes=%lld-"), Writer->GetSize()));
+			}
+
+			// If the file changed since, the server sends all of it with a 200 instead of the range
+			if (FileExists(ValidatorPath))
+			{
+				Request->SetHeader("If-Range", LoadTextFile(ValidatorPath).TrimStartAndEnd());
+			}
+		}
+
+		check(Request->SetResponseBodyReceiveStream(Writer));
+
+		// 416: the range starts past the end, the part file is complete or not from this file
+		const FHttpFuture Future = SendHttpRequest(Request, "GET", { 200, 206, 416 }, nullptr, false);
+		const FHttpResponse* Response = Future.TryGet();
+		Writer->Close();
+
+		if (Writer->NeedsRestart())
+		{
+			DeletePartFiles();
+
+			if (Attempt >= MaxAttempts)
+			{
+				LOG_FATAL("GET %s failed after %d attempts: the server keeps sending the whole file instead of the range", *Url, Attempt);
+			}
+
+			LOG("File changed since the partial download, restarting");
+			continue;
+		}
+
+		if (Response &&
+			Response->Code == 416)
+		{
+			// Content-Range: bytes */<length>, the total size of the file
+			const int64 CompleteSize = INLINE_LAMBDA -> int64
+			{
+				if (PrivateExpectedSize != -1)
+				{
+					return PrivateExpectedSize;
+				}
+
+				FString Length;
+				int64 Result = -1;
+				if (PrivateRangeStart != -1 ||
+					!Response->GetHeader("Content-Range").Split("*/", nullptr, &Length) ||
+					!IsDigits(Length.TrimStartAndEnd()) ||
+					!LexTryParseString(Result, *Length.TrimStartAndEnd()))
+				{
+					return -1;
+				}
+				return Result;
+			};
+
+			if (CompleteSize == -1 ||
+				Writer->GetSize() != CompleteSize)
+			{
+				// Don't spin forever if the server keeps answering 416
+				if (Attempt >= MaxAttempts)
+				{
+					DeletePartFiles();
+					LOG_FATAL("GET %s failed after %d attempts: range not satisfiable", *Url, Attempt);
+				}
+
+				LOG("Invalid partial download, restarting");
+				DeletePartFiles();
+				continue;
+			}
+		}
+		else if (!Response)
+		{
+			// Retrying won't make a missing file appear or a forbidden one accessible
+			const TSharedPtr<IHttpResponse> FailedResponse = Request->GetResponse();
+			const int32 Code = FailedResponse ? FailedResponse->GetResponseCode() : 0;
+			if (Code >= 400 &&
+				Code < 500 &&
+				Code != 408 &&
+				Code != 429)
+			{
+				LOG_FATAL("GET %s failed: %d", *Url, Code);
+			}
+
+			if (Attempt >= MaxAttempts)
+			{
+				LOG_FATAL("GET %s failed after %d attempts", *Url, Attempt);
+			}
+
+			const float Delay = FMath::Min(1 << Attempt, 30);
+			LOG("Attempt %d failed, retrying in %.0fs", Attempt, Delay);
+			FPlatformProcess::Sleep(Delay);
+			continue;
+		}
+
+		if (PrivateExpectedSize != -1 &&
+			Writer->GetSize() != PrivateExpectedSize)
+		{
+			DeletePartFiles();
+			LOG_FATAL("GET %s: expected %lld bytes, got %lld", *Url, PrivateExpectedSize, Writer->GetSize());
+		}
+
+		if (!PrivateExpectedSha1.IsEmpty() &&
+			!Writer->GetSha1().Equals(PrivateExpectedSha1, ESearchCase::IgnoreCase))
+		{
+			DeletePartFiles();
+			LOG_FATAL("GET %s: expected SHA-1 %s, got %s", *Url, *PrivateExpectedSha1, *Writer->GetSha1());
+		}
+
+		LOG("Downloaded %s", *BytesToString(Writer->GetSize()));
+		break;
+	}
+
+	if (FileExists(PrivateFilePath))
+	{
+		DeleteFile(PrivateFilePath);
+	}
+	MoveFile(PartPath, PrivateFilePath);
+
+	if (FileExists(ValidatorPath))
+	{
+		DeleteFile(ValidatorPath);
+	}
+}
+
+TSharedRef<IHttpRequest> FHttpGet::CreateRequest() const
 {
-	static const FUnrealVersion StaticUnrealVersion = INLINE_LAMBDA
+	LOG("GET %s", *Url);
+
+	if (!Headers.IsEmpty())
 	{
-		const FString UnrealVersionString = GetCommandLineValue("UnrealVersion");
+		LOG("\tHeaders:");
 
-		TArray<FString> MajorMinor;
-		UnrealVersionString.ParseIntoArray(MajorMinor, TEXT("."));
+		for (const auto& It : Headers)
+		{
+			LOG("\t\t%s: %s", *It.Key, *It.Value);
+		}
+	}
+
+	if (!QueryParameters.IsEmpty())
+	{
+		LOG("\tQuery parameters:");
+
+		for (const auto& It : QueryParameters)
+		{
+			LOG("\t\t%s: %s", *It.Key, *It.Value);
+		}
+	}
+
+	const TSharedRef<IHttpRequest> Request = FHttpModule::Get().CreateRequest();
+	Request->SetVerb("GET");
+
+	for (const auto& It : Headers)
+	{
+		Request->SetHeader(It.Key, It.Value);
+	}
+
+	FString FinalUrl = Url;
+	if (QueryParameters.Num() > 0)
+	{
+		FinalUrl += "?";
+
+		for (const auto& It : QueryParameters)
+		{
+			if (!FinalUrl.EndsWith("?"))
+			{
+				FinalUrl += "&";
+			}
+
+			if (It.Key != FPlatformHttp::UrlEncode(It.Key))
+			{
+				LOG_FATAL("Invalid query parameter key: %s", *It.Key);
+			}
+
+			FinalUrl += It.Key + "=" + FPlatformHttp::UrlEncode(It.Value);
+		}
+	}
+
+	Request->SetURL(FinalUrl);
+
+	if (PrivateRangeStart != -1)
+	{
+		Request->SetHeader("Range", FString::Printf(TEXT("bytes=%lld-%lld"), PrivateRangeStart, PrivateRangeEnd));
+	}
+
+	return Request;
+}
+
+FHttpGet Http_Get(const FString& Url)
+{
+	return FHttpGet(Url);
+}
+
+// Writes the body of a Range response at its offset in a preallocated file, so segments don't need to be merged
+// Cancels the request as soon as the response isn't the range asked for
+class FHttpSegmentWriter : public FArchive
+{
+public:
+	FHttpSegmentWriter(
+		const FString& Path,
+		const int64 Offset,
+		const int64 MaxLength,
+		const TSharedRef<IHttpRequest>& Request,
+		TFunction<void(int64 Written)> OnFlushed)
+		: Offset(Offset)
+		, MaxLength(MaxLength)
+		, WeakRequest(Request)
+		, OnFlushed(MoveTemp(OnFlushed))
+	{
+		SetIsSaving(true);
+
+		// Not truncated, writes go where Seek puts them
+		Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, true, false));
+		if (!Handle ||
+			!Handle->Seek(Offset))
+		{
+			LOG_FATAL("Failed to open %s for writing at %lld", *Path, Offset);
+		}
+	}
+
+	virtual void Serialize(void* Data, const int64 Length) override
+	{
+		if (!bCheckedResponse)
+		{
+			bCheckedResponse = true;
+
+			const TSharedPtr<IHttpRequest> Request = WeakRequest.Pin();
+			const TSharedPtr<IHttpResponse> Response = Request ? Request->GetResponse() : nullptr;
+			const int32 Code = Response ? Response->GetResponseCode() : 0;
+
+			if (Code != 206)
+			{
+				// 200: the If-Range didn't match, the file changed since HEAD
+				bFileChanged = Code == 200;
+				bDiscard = true;
+			}
+			else if (!Response->GetHeader("Content-Range").StartsWith(FString::Printf(TEXT("bytes %lld-"), Offset)))
+			{
+				LOG("Unexpected Content-Range: %s", *Response->GetHeader("Content-Range"));
+				bDiscard = true;
+			}
+
+			if (bDiscard)
+			{
+				SetError();
+				if (Request)
+				{
+					Request->CancelRequest();
+				}
+			}
+		}
+
+		if (bDiscard)
+		{
+			return;
+		}
+
+		if (Written + Length > MaxLength ||
+			!Handle ||
+			!Handle->Write(static_cast<const uint8*>(Data), Length))
+		{
+			bDiscard = true;
+			SetError();
+			return;
+		}
+
+		Written += Length;
+
+		// Only report progress once it's on disk, so that a resume never skips bytes that were lost
+		if (Written - FlushedWritten >= 64 * 1024 * 1024)
+		{
+			Flush();
+		}
+	}
+	virtual int64 Tell() override
+	{
+		return Offset + Written;
+	}
+	virtual int64 TotalSize() override
+	{
+		return Offset + Written;
+	}
+	virtual FString GetArchiveName() const override
+	{
+		return "FHttpSegmentWriter";
+	}
+
+	bool HasFileChanged() const
+	{
+		return bFileChanged;
+	}
+	void Close()
+	{
+		Flush();
+		Handle.Reset();
+	}
+
+private:
+	const int64 Offset;
+	const int64 MaxLength;
+	const TWeakPtr<IHttpRequest> WeakRequest;
+	const TFunction<void(int64 Written)> OnFlushed;
+
+	TUniquePtr<IFileHandle> Handle;
+	int64 Written = 0;
+	int64 FlushedWritten = 0;
+	bool bCheckedResponse = false;
+	bool bDiscard = false;
+	bool bFileChanged = false;
+
+	void Flush()
+	{
+		if (!Handle ||
+			Written == FlushedWritten ||
+			!Handle->Flush())
+		{
+			return;
+		}
+
+		FlushedWritten = Written;
+		OnFlushed(Written);
+	}
+};
+
+// Downloads the segments of Path.part in parallel, each writing at its offset
+// Progress is saved to Path.part.segments along with the validator, so that another run can resume it
+// Returns false if the file changed since HEAD
+bool Http_TryDownloadSegments(
+	const FString& Url,
+	const FString& Path,
+	const FString& ExpectedSha1,
+	const int32 NumSegments,
+	const TMap<FString, FString>& Headers,
+	const int64 Size,
+	const FString& Validator)
+{
+	struct FSegment
+	{
+		int64 Start = 0;
+		int64 End = 0;
+		int64 Done = 0;
+	};
+
+	const FString PartPath = Path + ".part";
+	const FString StatePath = Path + ".part.segments";
+
+	FCriticalSection StateCriticalSection;
+	TArray<FSegment> Segments;
+
+	// Validator, size, then one "start end done" line per segment
+	const auto SaveState = [&]
+	{
+		FScopeLock Lock(&StateCriticalSection);
+
+		FString Text = Validator + "\n" + LexToString(Size) + "\n";
+		for (const FSegment& Segment : Segments)
+		{
+			Text += FString::Printf(TEXT("%lld %lld %lld\n"), Segment.Start, Segment.End, Segment.Done);
+		}
+
+		if (!FFileHelper::SaveStringToFile(Text, *StatePath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM))
+		{
+			LOG_FATAL("Failed to save %s", *StatePath);
+		}
+	};
 
-		if (MajorMinor.Num() != 2)
+	const auto LoadState = [&]
+	{
+		if (!FileExists(StatePath) ||
+			!FileExists(PartPath) ||
+			FileSize(PartPath) != Size)
 		{
-			LOG_FATAL("Invalid UnrealVersion %s: should be X.X, eg 5.4", *UnrealVersionString);
+			return false;
 		}
 
-		FUnrealVersion UnrealVersion;
-		UnrealVersion.Major = StringToInt(MajorMinor[0]);
-		UnrealVersion.Minor = StringToInt(MajorMinor[1]);
+		TArray<FString> Lines;
+		LoadTextFile(StatePath).ParseIntoArrayLines(Lines);
 
-		LOG("Unreal Version: %s", *UnrealVersion.ToString());
+		if (Lines.Num() < 3 ||
+			Lines[0] != Validator ||
+			Lines[1] != LexToString(Size))
+		{
+			return false;
+		}
 
-		return UnrealVersion;
+		for (int32 Index = 2; Index < Lines.Num(); Index++)
+		{
+			TArray<FString> Numbers;
+			Lines[Index].ParseIntoArrayWS(Numbers);
+
+			FSegment Segment;
+			if (Numbers.Num() != 3 ||
+				!IsDigits(Numbers[0]) ||
+				!IsDigits(Numbers[1]) ||
+				!IsDigits(Numbers[2]) ||
+				!LexTryParseString(Segment.Start, *Numbers[0]) ||
+				!LexTryParseString(Segment.End, *Numbers[1]) ||
+				!LexTryParseString(Segment.Done, *Numbers[2]) ||
+				Segment.Start > Segment.End ||
+				Segment.End >= Size ||
+				Segment.Done > Segment.End - Segment.Start + 1)
+			{
+				Segments.Reset();
+				return false;
+			}
+			Segments.Add(Segment);
+		}
+		return true;
 	};
 
-	return StaticUnrealVersion;
-}
-
-void SetupLinuxToolchainFor(const FUnrealVersion& UnrealVersion)
-{
-	FString Path;
-
-	if (UnrealVersion.ToString() == "5.4")
-	{
-		Path = "C:/UnrealToolchains/v22_clang-16.0.6-centos7/";
-	}
-	else if (UnrealVersion.ToString() == "5.5")
-	{
-		Path = "C:/UnrealToolchains/v23_clang-18.1.0-rockylinux8/";
-	}
-	else if (UnrealVersion.ToString() == "5.6")
-	{
-		Path = "C:/UnrealToolchains/v25_clang-18.1.0-rockylinux8/";
-	}
-	else if (UnrealVersion.ToString() == "5.7")
+	if (LoadState())
 	{
-		Path = "C:/UnrealToolchains/v26_clang-20.1.8-rockylinux8/";
+		LOG("Resuming %d segments of %s", Segments.Num(), *PartPath);
 	}
 	else
 	{
-		LOG_FATAL("Unsupported version: %s, need to update SetupLinuxToolchainFor", *UnrealVersion.ToString());
-	}
+		constexpr int64 MinSegmentSize = 4 * 1024 * 1024;
+		const int32 FinalNumSegments = int32(FMath::Clamp<int64>(Size / MinSegmentSize, 1, NumSegments));
+		const int64 SegmentSize = FMath::DivideAndRoundUp<int64>(Size, FinalNumSegments);
 
-	if (!DirectoryExists(Path))
-	{
-		LOG_FATAL("Missing Linux toolchain: %s", *Path);
+		LOG("%s in %d segments of %s", *BytesToString(Size), FinalNumSegments, *BytesToString(SegmentSize));
+
+		Segments.Reset();
+		for (int64 Start = 0; Start < Size; Start += SegmentSize)
+		{
+			FSegment& Segment = Segments.Emplace_GetRef();
+			Segment.Start = Start;
+			Segment.End = FMath::Min(Start + SegmentSize, Size) - 1;
+		}
+
+		// Left by a single connection download, would make it resume from this file
+		if (FileExists(PartPath + ".validator"))
+		{
+			DeleteFile(PartPath + ".validator");
+		}
+
+		// Preallocate, segments then write at their offset
+		{
+			const TUniquePtr<IFileHandle> Handle(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*PartPath));
+			const uint8 Zero = 0;
+			if (!Handle ||
+				!Handle->Seek(Size - 1) ||
+				!Handle->Write(&Zero, 1))
+			{
+				LOG_FATAL("Failed to allocate %s", *PartPath);
+			}
+		}
+
+		SaveState();
 	}
 
-	FPlatformMisc::SetEnvironmentVar(TEXT("LINUX_MULTIARCH_ROOT"), *Path);
-}
+	std::atomic<bool> bFileChanged = false;
 
-FString GetEnginePath(
-	const FUnrealVersion& UnrealVersion,
-	const EEngineType EngineType)
-{
-	const FString Path = INLINE_LAMBDA
+	const auto DownloadSegment = [&](const int32 Index)
 	{
-		static const TArray<FString> EngineDirectories =
-			IsWindows()
-			?
-			TArray<FString>
+		const FString Prefix = FString::Printf(TEXT("[Segment %d] "), Index);
+		constexpr int32 MaxAttempts = 5;
+
+		for (int32 Attempt = 1; !bFileChanged; Attempt++)
+		{
+			FSegment Segment;
 			{
-				"C:/BUILD",
-				"D:/BUILD",
-				"C:/ROOT",
-				"D:/ROOT",
-				"C:/Program Files/Epic Games/",
-				GetRootDirectory()
+				FScopeLock Lock(&StateCriticalSection);
+				Segment = Segments[Index];
 			}
-			:
-			TArray<FString>
+
+			const int64 Start = Segment.Start + Segment.Done;
+			if (Start > Segment.End)
 			{
-				"/Users/Shared/",
-				"/Users/Shared/Epic Games/",
-				FString(FPlatformProcess::UserHomeDir()),
-				FString(FPlatformProcess::UserHomeDir()) / "ROOT"
-			};
+				return;
+			}
 
-		const TArray<FString> EngineNames =
-		{
-			"UE_" + UnrealVersion.ToString(),
-			"UnrealEngine-" + UnrealVersion.ToString(),
-		};
+			LOG("%sGET bytes %lld-%lld", *Prefix, Start, Segment.End);
 
-		TArray<FString> Candidates;
-		for (const FString& Directory : EngineDirectories)
-		{
-			for (const FString& EngineName : EngineNames)
+			const TSharedRef<IHttpRequest> Request = FHttpModule::Get().CreateRequest();
+			Request->SetVerb("GET");
+			Request->SetURL(Url);
+			for (const auto& It : Headers)
 			{
-				const FString EnginePath = Directory / EngineName;
-				Candidates.Add(EnginePath);
+				Request->SetHeader(It.Key, It.Value);
+			}
+			Request->SetHeader("Range", FString::Printf(TEXT("bytes=%lld-%lld"), Start, Segment.End));
+			// Every segment must come from the version of the file HEAD described
+			Request->SetHeader("If-Range", Validator);
 
-				if (EngineType == EEngineType::Source)
+			const auto UpdateDone = [&, Index, Done = Segment.Done](const int64 Written)
+			{
 				{
-					if (DirectoryExists(EnginePath / ".git"))
-					{
-						return EnginePath;
-					}
+					FScopeLock Lock(&StateCriticalSection);
+					Segments[Index].Done = Done + Written;
 				}
-				else
-				{
-					check(EngineType == EEngineType::Launcher);
+				SaveState();
+			};
 
-					if (FileExists(EnginePath / "Engine" / "Build" / "Build.version"))
-					{
-						return EnginePath;
-					}
+			const TSharedRef<FHttpSegmentWriter> Writer = MakeShared<FHttpSegmentWriter>(
+				PartPath,
+				Start,
+				Segment.End - Start + 1,
+				Request,
+				UpdateDone);
+
+			check(Request->SetResponseBodyReceiveStream(Writer));
+
+			const FHttpFuture Future = SendHttpRequest(Request, "GET", { 206 }, nullptr, false);
+			const FHttpResponse* Response = Future.TryGet();
+			Writer->Close();
+
+			if (Writer->HasFileChanged())
+			{
+				LOG("%s%s changed since HEAD", *Prefix, *Url);
+				bFileChanged = true;
+				return;
+			}
+
+			if (Response)
+			{
+				FScopeLock Lock(&StateCriticalSection);
+				if (Segments[Index].Done == Segments[Index].End - Segments[Index].Start + 1)
+				{
+					LOG("%sdone", *Prefix);
+					return;
 				}
 			}
-		}
 
-		LOG_FATAL("Failed to find engine for %s. Looked in \n%s",
-			*UnrealVersion.ToString(),
-			*FString::Join(Candidates, TEXT("\n")));
+			const TSharedPtr<IHttpResponse> FailedResponse = Request->GetResponse();
+			const int32 Code = FailedResponse ? FailedResponse->GetResponseCode() : 0;
+			if (Code >= 400 &&
+				Code < 500 &&
+				Code != 408 &&
+				Code != 429)
+			{
+				LOG_FATAL("%sGET %s failed: %d", *Prefix, *Url, Code);
+			}
+
+			if (Attempt >= MaxAttempts)
+			{
+				LOG_FATAL("%sGET %s failed after %d attempts", *Prefix, *Url, Attempt);
+			}
 
-			return FString();
+			const float Delay = FMath::Min(1 << Attempt, 30);
+			LOG("%sattempt %d failed, retrying in %.0fs", *Prefix, Attempt, Delay);
+			FPlatformProcess::Sleep(Delay);
+		}
 	};
-	check(DirectoryExists(Path));
 
-	if (EngineType == EEngineType::Source)
+	// Segments log with a prefix, LOG_SCOPE from several threads would interleave the TeamCity blocks
+	TArray<TFuture<void>> Futures;
+	for (int32 Index = 0; Index < Segments.Num(); Index++)
 	{
-		static TSet<FString> UpdatedEngines;
+		Futures.Add(Async(EAsyncExecution::Thread, [&DownloadSegment, Index]
+		{
+			DownloadSegment(Index);
+		}));
+	}
 
-		if (!UpdatedEngines.Contains(UnrealVersion.ToString()))
+	for (const TFuture<void>& Future : Futures)
+	{
+		while (!Future.WaitFor(FTimespan::FromMilliseconds(10)))
 		{
-			UpdatedEngines.Add(UnrealVersion.ToString());
+			// Without a dedicated HTTP thread, requests only progress when the manager is ticked
+			if (IsInGameThread())
+			{
+				FHttpModule::Get().GetHttpManager().Tick(0.f);
+			}
+		}
+	}
 
-			LOG_SCOPE("Update engine");
+	if (bFileChanged)
+	{
+		DeleteFile(PartPath);
+		DeleteFile(StatePath);
+		return false;
+	}
 
-			const FString WorkingDirectory = GetWorkingDirectory();
-			ON_SCOPE_EXIT
-			{
-				SetWorkingDirectory(WorkingDirectory);
-			};
+	if (!ExpectedSha1.IsEmpty())
+	{
+		LOG_SCOPE("Hash %s", *PartPath);
 
-			SetWorkingDirectory(Path);
+		const TUniquePtr<IFileHandle> ReadHandle(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*PartPath));
+		check(ReadHandle);
 
-			Exec("git fetch origin " + UnrealVersion.ToString());
-			Exec("git merge FETCH_HEAD");
-		}
-	}
+		TArray<uint8> Buffer;
+		Buffer.SetNumUninitialized(4 * 1024 * 1024);
 
-	return Path;
-}
+		FSHA1 Sha;
+		for (int64 Offset = 0; Offset < Size; Offset += Buffer.Num())
+		{
+			const int64 ChunkSize = FMath::Min<int64>(Buffer.Num(), Size - Offset);
+			check(ReadHandle->Read(Buffer.GetData(), ChunkSize));
+			Sha.Update(Buffer.GetData(), ChunkSize);
+		}
+		Sha.Final();
 
-FString GetRunUATPath(
-	const FUnrealVersion& UnrealVersion,
-	const EEngineType EngineType)
-{
-	const FString EnginePath = GetEnginePath(UnrealVersion, EngineType);
+		FSHAHash Hash;
+		Sha.GetHash(Hash.Hash);
 
-	if (IsWindows())
-	{
-		return EnginePath / "Engine/Build/BatchFiles/RunUAT.bat";
+		if (!Hash.ToString().Equals(ExpectedSha1, ESearchCase::IgnoreCase))
+		{
+			DeleteFile(PartPath);
+			DeleteFile(StatePath);
+			LOG_FATAL("Segmented download %s: expected SHA-1 %s, got %s", *Url, *ExpectedSha1, *Hash.ToString().ToLower());
+		}
 	}
-	else
+
+	if (FileExists(Path))
 	{
-		return EnginePath / "Engine/Build/BatchFiles/RunUAT.sh";
+		DeleteFile(Path);
 	}
+	MoveFile(PartPath, Path);
+	DeleteFile(StatePath);
+
+	return true;
 }
 
-FString RunUAT(
-	const FUnrealVersion& UnrealVersion,
-	const EEngineType EngineType,
-	const FString& Command)
+void Http_DownloadSegmented(
+	const FString& Url,
+	const FString& Path,
+	const FString& ExpectedSha1,
+	const int32 NumSegments,
+	const TMap<FString, FString>& Headers)
 {
-	return Exec_PostErrors(FString::Printf(
-		TEXT("\"%s\" %s"),
-		*GetRunUATPath(UnrealVersion, EngineType),
-		*Command));
-}
+	check(NumSegments >= 1);
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
+	LOG_SCOPE("Segmented download %s", *Path);
 
-FHttpGet::~FHttpGet()
-{
-	LOG("GET %s", *Url);
+	MakeDirectory(FPaths::GetPath(Path));
 
-	if (!Headers.IsEmpty())
+	// If the file changes while the segments are downloading, start over once with a new HEAD
+	for (int32 Pass = 0; ; Pass++)
 	{
-		LOG("\tHeaders:");
-
+		// Probe the size and range support without downloading anything
+		const TSharedRef<IHttpRequest> HeadRequest = FHttpModule::Get().CreateRequest();
+		HeadRequest->SetVerb("HEAD");
+		HeadRequest->SetURL(Url);
 		for (const auto& It : Headers)
 		{
-			LOG("\t\t%s: %s", *It.Key, *It.Value);
+			HeadRequest->SetHeader(It.Key, It.Value);
 		}
-	}
 
-	if (!QueryParameters.IsEmpty())
-	{
-		LOG("\tQuery parameters:");
+		LOG("HEAD %s", *Url);
+		const FHttpFuture HeadFuture = SendHttpRequest(HeadRequest, "HEAD", { 200 }, nullptr, false);
+		const FHttpResponse* HeadResponse = HeadFuture.TryGet();
 
-		for (const auto& It : QueryParameters)
+		// Chunked or generated responses have no Content-Length, download those with a single connection
+		const int64 Size = INLINE_LAMBDA -> int64
 		{
-			LOG("\t\t%s: %s", *It.Key, *It.Value);
-		}
-	}
-
-	const TSharedRef<IHttpRequest> Request = FHttpModule::Get().CreateRequest();
-	Request->SetVerb("GET");
+			if (!HeadResponse)
+			{
+				return 0;
+			}
 
-	for (const auto& It : Headers)
-	{
-		Request->SetHeader(It.Key, It.Value);
-	}
+			int64 Result = 0;
+			const FString ContentLength = HeadResponse->GetHeader("Content-Length");
+			if (!IsDigits(ContentLength) ||
+				ContentLength.Len() > 18 ||
+				!LexTryParseString(Result, *ContentLength))
+			{
+				return 0;
+			}
+			return Result;
+		};
+		constexpr int64 MinSegmentSize = 4 * 1024 * 1024;
 
-	FString FinalUrl = Url;
-	if (QueryParameters.Num() > 0)
-	{
-		FinalUrl += "?";
+		// Ties the segments together, without it they could come from different versions of the file
+		const FString Validator = HeadResponse ? GetHttpValidator(HeadResponse->GetHeader("ETag"), HeadResponse->GetHeader("Last-Modified")) : FString();
 
-		for (const auto& It : QueryParameters)
+		if (!HeadResponse ||
+			!HeadResponse->GetHeader("Accept-Ranges").Equals("bytes", ESearchCase::IgnoreCase) ||
+			Validator.IsEmpty() ||
+			Size < 2 * MinSegmentSize ||
+			NumSegments == 1)
 		{
-			if (!FinalUrl.EndsWith("?"))
-			{
-				FinalUrl += "&";
-			}
+			LOG("Server doesn't support ranges, the file has no ETag or Last-Modified or is small, downloading with a single connection");
 
-			if (It.Key != FPlatformHttp::UrlEncode(It.Key))
+			FHttpGet Get(Url);
+			for (const auto& It : Headers)
 			{
-				LOG_FATAL("Invalid query parameter key: %s", *It.Key);
+				Get.Header(It.Key, It.Value);
 			}
+			Get.ToFile(Path, ExpectedSha1);
+			return;
+		}
 
-			FinalUrl += It.Key + "=" + FPlatformHttp::UrlEncode(It.Value);
+		if (Http_TryDownloadSegments(Url, Path, ExpectedSha1, NumSegments, Headers, Size, Validator))
+		{
+			return;
 		}
-	}
 
-	Request->SetURL(FinalUrl);
+		if (Pass > 0)
+		{
+			LOG_FATAL("Segmented download %s: the file keeps changing", *Url);
+		}
+		LOG("%s changed during the download, starting over", *Url);
+	}
+}
 
-	Request->ProcessRequest();
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
 
-	while (Request->GetStatus() == EHttpRequestStatus::Processing)
+// Hands the content to the HTTP module without copying it into a TArray<uint8>, which is limited to 2GB
+class FHttpContentReader : public FArchive
+{
+public:
+	explicit FHttpContentReader(TArray64<uint8>&& Data)
+		: Data(MoveTemp(Data))
 	{
-		FHttpModule::Get().GetHttpManager().Tick(0.f);
+		SetIsLoading(true);
 	}
 
-	const TSharedPtr<IHttpResponse> Response = Request->GetResponse();
-	if (!Response)
+	virtual void Serialize(void* Value, const int64 Length) override
 	{
-		LOG_FATAL("GET failed: Failed to connect");
-	}
+		if (Offset + Length > Data.Num())
+		{
+			SetError();
+			return;
+		}
 
-	if (Response->GetResponseCode() != 200)
+		FMemory::Memcpy(Value, Data.GetData() + Offset, Length);
+		Offset += Length;
+	}
+	virtual int64 Tell() override
 	{
-		LOG_FATAL("GET failed: %d\n%s",
-			Response->GetResponseCode(),
-			*Response->GetContentAsString());
+		return Offset;
+	}
+	virtual int64 TotalSize() override
+	{
+		return Data.Num();
+	}
+	virtual void Seek(const int64 NewOffset) override
+	{
+		check(NewOffset >= 0 && NewOffset <= Data.Num());
+		Offset = NewOffset;
+	}
+	virtual FString GetArchiveName() const override
+	{
+		return "FHttpContentReader";
 	}
 
-	check(Request->GetStatus() == EHttpRequestStatus::Succeeded);
-
-	LOG("RESPONSE: %d\n%s",
-		Response->GetResponseCode(),
-		*Response->GetContentAsString());
-}
+private:
+	const TArray64<uint8> Data;
+	int64 Offset = 0;
+};
 
-FHttpGet Http_Get(const FString& Url)
+FHttpPost::~FHttpPost()
 {
-	return FHttpGet(Url);
+	if (!bSent)
+	{
+		Send().Get();
+	}
 }
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
-FHttpPost::~FHttpPost()
+FHttpFuture FHttpPost::Send()
 {
+	check(!bSent);
+	bSent = true;
+
 	LOG("POST %s", *Url);
 
 	if (!Headers.IsEmpty())
@@ -994,6 +6346,8 @@ FHttpPost::~FHttpPost()
 
 	Request->SetURL(FinalUrl);
 
+	check(int32(!PrivateContent.IsEmpty()) + int32(PrivateContent_Bytes.Num() > 0) + int32(!PrivateContent_Path.IsEmpty()) <= 1);
+
 	if (!PrivateContent.IsEmpty())
 	{
 		Request->SetContentAsString(PrivateContent);
@@ -1001,41 +6355,25 @@ FHttpPost::~FHttpPost()
 
 	if (PrivateContent_Bytes.Num() > 0)
 	{
-		check(PrivateContent_Bytes.Num() < MAX_int32);
-		Request->SetContent(TArray<uint8>(MoveTemp(PrivateContent_Bytes)));
-	}
-
-	Request->ProcessRequest();
-
-	while (Request->GetStatus() == EHttpRequestStatus::Processing)
-	{
-		FHttpModule::Get().GetHttpManager().Tick(0.f);
-	}
+		LOG("\tContent: %s", *BytesToString(PrivateContent_Bytes.Num()));
 
-	const TSharedPtr<IHttpResponse> Response = Request->GetResponse();
-	if (!Response)
-	{
-		LOG_FATAL("POST failed: Failed to connect");
+		check(Request->SetContentFromStream(MakeShared<FHttpContentReader, ESPMode::ThreadSafe>(MoveTemp(PrivateContent_Bytes))));
 	}
 
-	if (Response->GetResponseCode() != 200 &&
-		Response->GetResponseCode() != 201)
+	if (!PrivateContent_Path.IsEmpty())
 	{
-		LOG_FATAL("POST failed: %d\n%s",
-			Response->GetResponseCode(),
-			*Response->GetContentAsString());
-	}
-
-	check(Request->GetStatus() == EHttpRequestStatus::Succeeded);
+		if (!FileExists(PrivateContent_Path))
+		{
+			LOG_FATAL("POST failed: %s does not exist", *PrivateContent_Path);
+		}
 
-	LOG("RESPONSE: %d\n%s",
-		Response->GetResponseCode(),
-		*Response->GetContentAsString());
+		LOG("\tContent: %s (%s)", *PrivateContent_Path, *BytesToString(FileSize(PrivateContent_Path)));
 
-	if (PrivateOnComplete)
-	{
-		PrivateOnComplete(Response->GetContentAsString());
+		// Sent with a Content-Length, read in chunks as the upload progresses
+		check(Request->SetContentAsStreamedFile(PrivateContent_Path));
 	}
+
+	return SendHttpRequest(Request, "POST", { 200, 201 }, MoveTemp(PrivateOnComplete));
 }
 
 FHttpPost Http_Post(const FString& Url)
@@ -1995,6 +7333,8 @@ int32 UForgeCommandlet::Main(const FString& Params)
 
 	Function();
 
+	LogExecStats();
+
 	if (OutputDevice->Warnings.Num() > 0 ||
 		OutputDevice->Errors.Num() > 0)
 	{
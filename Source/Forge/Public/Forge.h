@@ -91,13 +91,106 @@ FORGE_API FString GetRootDirectory();
 FORGE_API FString GetWorkingDirectory();
 FORGE_API void SetWorkingDirectory(const FString& NewWorkingDirectory);
 
+// Overrides the working directory of the current thread only, until destroyed
+// SetWorkingDirectory calls made in the scope also only affect the current thread
+class FORGE_API FScopedWorkingDirectory
+{
+public:
+	explicit FScopedWorkingDirectory(const FString& WorkingDirectory);
+	~FScopedWorkingDirectory();
+
+	UE_NONCOPYABLE(FScopedWorkingDirectory);
+
+private:
+	FString WorkingDirectory;
+	FString* PreviousWorkingDirectory = nullptr;
+};
+
 FORGE_API FString Exec(
 	const FString& CommandLine,
 	const TSet<int32>& ValidExitCodes = { 0 });
 
+// Ordered by priority: a line matching several filters gets the highest type
+enum class EExecLineType : uint8
+{
+	Normal,
+	Warning,
+	Error,
+	// Never counted as a warning or error
+	Ignored,
+	// Not even logged
+	Suppressed
+};
+
+// Filters are built in, plus the project's Config/ForgeOutputFilters.txt if it exists
+// Each line of that file is: <suppress|ignore|error|warning> <contains|prefix> <text>
+FORGE_API EExecLineType ClassifyExecLine(FStringView Line);
+
+struct FORGE_API FExecDiagnostic
+{
+	// Error or Warning
+	EExecLineType Severity = EExecLineType::Error;
+	// Empty for diagnostics without location, eg UAT errors
+	FString File;
+	int32 Line = 0;
+	int32 Column = 0;
+	// eg C4668, LNK2019, -Wshadow or LogInit
+	FString Code;
+	FString Message;
+	// Number of times it was printed
+	int32 Count = 1;
+
+	FString ToString() const;
+};
+
+// Parses clang, MSVC, linker, UBT, UAT and Unreal log diagnostics out of output lines as they arrive
+// Diagnostics printed again by other translation units or template instantiations are only reported once
+class FORGE_API FExecDiagnosticParser
+{
+public:
+	// Called for each new diagnostic
+	TFunction<void(const FExecDiagnostic& Diagnostic)> OnDiagnostic;
+
+	// Lines classified as Ignored or Suppressed are skipped
+	void AddLine(const FString& Line);
+
+	const TArray<FExecDiagnostic>& GetDiagnostics() const
+	{
+		return Diagnostics;
+	}
+	int32 GetNumErrors() const
+	{
+		return NumErrors;
+	}
+
+	static bool Parse(
+		FStringView Text,
+		FExecDiagnostic& OutDiagnostic);
+
+	static void LogTeamCityInspection(const FExecDiagnostic& Diagnostic);
+
+private:
+	TArray<FExecDiagnostic> Diagnostics;
+	TMap<FString, int32> KeyToIndex;
+	int32 NumErrors = 0;
+};
+
+// Only runs CommandLine once per working directory and InvalidationToken, and returns the cached output afterwards
+// Use for commands whose output only depends on the token, eg the HEAD revision
+// Running any other git command in the same working directory invalidates the cache once it finishes
+// git -C, other worktrees or scripts calling git don't: the token must capture everything the output depends on
+FORGE_API FString Exec_Cached(
+	const FString& CommandLine,
+	const FString& InvalidationToken = {});
+
+// Clears the Exec_Cached results of the current working directory
+FORGE_API void InvalidateExecCache();
+
+// Only the last MaxOutputLines lines are kept and returned, long builds don't hold their whole log in memory
 FORGE_API FString Exec_PostErrors(
 	const FString& CommandLine,
-	const TSet<int32>& ValidExitCodes = { 0 });
+	const TSet<int32>& ValidExitCodes = { 0 },
+	int32 MaxOutputLines = 10000);
 
 FORGE_API bool TryExec(
 	const FString& CommandLine,
@@ -108,6 +201,84 @@ FORGE_API bool TryExec(
 	FString& Output,
 	const TSet<int32>& ValidExitCodes = { 0 });
 
+// Calls OnLine for every line of output as it arrives instead of accumulating it all,
+// memory stays constant however long the command runs. Returns the last MaxTailLines lines.
+FORGE_API FString Exec(
+	const FString& CommandLine,
+	TFunctionRef<void(const FString& Line)> OnLine,
+	int32 MaxTailLines = 0,
+	const TSet<int32>& ValidExitCodes = { 0 });
+
+FORGE_API bool TryExec(
+	const FString& CommandLine,
+	TFunctionRef<void(const FString& Line)> OnLine,
+	FString& Tail,
+	int32 MaxTailLines = 0,
+	const TSet<int32>& ValidExitCodes = { 0 });
+
+// Runs commands in parallel, respecting dependencies
+// Each node uses Weight CPU slots and Memory bytes out of the budget given to Run
+class FORGE_API FExecGraph
+{
+public:
+	struct FNode
+	{
+		FString Name;
+		FString CommandLine;
+		FString WorkingDirectory;
+		// Set in the environment of this command only
+		TMap<FString, FString> Environment;
+		TSet<int32> ValidExitCodes = { 0 };
+		TArray<int32> Dependencies;
+		int32 Weight = 1;
+		int64 Memory = 0;
+		// Classify the output like Exec_PostErrors and post the errors to TeamCity if the command fails
+		// Only the tail of the output is kept
+		bool bPostErrors = false;
+		// Called on the thread of the node before the command runs
+		// To wait for something only this node needs without holding back the others
+		TFunction<void()> OnStart;
+
+		bool bSuccess = false;
+		bool bSkipped = false;
+		int32 ExitCode = -1;
+		double Duration = 0;
+		FString Output;
+		// Set if bPostErrors and the command failed
+		TArray<FString> Errors;
+	};
+
+	// Dependencies must be indices returned by previous calls to Add
+	int32 Add(
+		const FString& Name,
+		const FString& CommandLine,
+		const TArray<int32>& Dependencies = {},
+		int32 Weight = 1,
+		int64 Memory = 0);
+
+	FNode& GetNode(const int32 Index)
+	{
+		return Nodes[Index];
+	}
+	const TArray<FNode>& GetNodes() const
+	{
+		return Nodes;
+	}
+
+	// MaxSlots defaults to the number of cores, MaxMemory to the available physical memory
+	// Nodes depending on a failed node are skipped
+	bool TryRun(
+		int32 MaxSlots = -1,
+		int64 MaxMemory = -1);
+
+	void Run(
+		int32 MaxSlots = -1,
+		int64 MaxMemory = -1);
+
+private:
+	TArray<FNode> Nodes;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -115,7 +286,101 @@ FORGE_API bool TryExec(
 FORGE_API FString Git_GetRevision();
 FORGE_API FString Git_GetShortRevision();
 FORGE_API int32 Git_GetChangelist();
-FORGE_API void Git_Fetch();
+
+struct FGitFetchResult
+{
+	struct FRef
+	{
+		FString Name;
+		// Empty if the ref was created
+		FString OldRevision;
+		// Empty if the ref was pruned
+		FString NewRevision;
+	};
+	TArray<FRef> UpdatedRefs;
+
+	FString OldHead;
+	FString NewHead;
+
+	// True if the working tree had local changes that were reset and cleaned
+	bool bCleanedWorkingTree = false;
+
+	bool HasChanges() const
+	{
+		return
+			UpdatedRefs.Num() > 0 ||
+			OldHead != NewHead ||
+			bCleanedWorkingTree;
+	}
+};
+// Only resets and cleans the working tree if git status reports changes
+// Fetches branches and tags in a single command and fast-forwards to the upstream branch
+// Remote defaults to the remote of the current branch
+FORGE_API FGitFetchResult Git_Fetch(const FString& Remote = {});
+
+// Bare repository under GetRootDirectory() holding the objects of Url
+// Clones borrow its objects through objects/info/alternates, so they are only downloaded and stored once
+FORGE_API FString Git_GetMirror(const FString& Url);
+
+// Fetches Branch from origin into the shared mirror, at most once per process,
+// then from the mirror into the repository in the current working directory
+// Leaves the fetched commit in FETCH_HEAD
+FORGE_API void Git_FetchThroughMirror(const FString& Branch);
+
+// Resets and cleans the working tree, only if git status reports changes
+// Returns true if anything was reset
+FORGE_API bool Git_ResetIfDirty();
+
+// Pool of git worktrees of one repository, sharing its object store
+// Worktrees are created on demand under GetRootDirectory()/Worktrees and kept across runs
+class FORGE_API FGitWorktreePool
+{
+public:
+	explicit FGitWorktreePool(
+		const FString& RepositoryPath,
+		int32 MaxWorktrees = 4);
+	~FGitWorktreePool();
+
+	UE_NONCOPYABLE(FGitWorktreePool);
+
+	// Leases a worktree checked out at Revision, waiting if all of them are in use
+	// The worktree is the working directory of the current thread until the lease is destroyed
+	class FORGE_API FLease
+	{
+	public:
+		FLease(
+			FGitWorktreePool& Pool,
+			const FString& Revision);
+		~FLease();
+
+		UE_NONCOPYABLE(FLease);
+
+		const FString& GetPath() const
+		{
+			return Path;
+		}
+
+	private:
+		FGitWorktreePool& Pool;
+		FString Path;
+		FScopedWorkingDirectory ScopedWorkingDirectory;
+	};
+
+private:
+	const FString RepositoryPath;
+	const FString RootPath;
+	const int32 MaxWorktrees;
+
+	FCriticalSection CriticalSection;
+	FEvent* ReleasedEvent = nullptr;
+	int32 NumLeased = 0;
+	// Worktree path -> revision it is checked out at
+	TMap<FString, FString> FreeWorktrees;
+	TSet<FString> LeasedWorktrees;
+
+	FString Acquire(const FString& Revision);
+	void Release(const FString& Path);
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -153,7 +418,17 @@ struct FUnrealVersion
 };
 FORGE_API FUnrealVersion GetCommandLineUnrealVersion();
 
-FORGE_API void SetupLinuxToolchainFor(const FUnrealVersion& UnrealVersion);
+FORGE_API FString GetLinuxToolchainPath(const FUnrealVersion& UnrealVersion);
+// LINUX_MULTIARCH_ROOT and, if ccache is available, the variables needed to compile Platform through it
+// ccache is found in PATH or given with -CompilerCache=, -NoCompilerCache disables it
+FORGE_API TMap<FString, FString> GetLinuxToolchainEnvironment(
+	const FUnrealVersion& UnrealVersion,
+	const FString& Platform = "Linux");
+// Sets LINUX_MULTIARCH_ROOT for every command run afterwards, replacing the previous toolchain
+// The process environment is left untouched. Use FRunUATMatrix to build several versions at once
+FORGE_API void SetupLinuxToolchainFor(
+	const FUnrealVersion& UnrealVersion,
+	const FString& Platform = "Linux");
 
 enum class EEngineType
 {
@@ -161,10 +436,27 @@ enum class EEngineType
 	Launcher
 };
 
+struct FEngineInfo
+{
+	FString Path;
+	EEngineType EngineType = EEngineType::Launcher;
+	// From Engine/Build/Build.version, 0 if it doesn't exist
+	int32 PatchVersion = 0;
+	int32 Changelist = 0;
+};
+// Engines are scanned once per process, with the results cached on disk
+FORGE_API FEngineInfo GetEngineInfo(
+	const FUnrealVersion& UnrealVersion,
+	EEngineType EngineType);
+
 FORGE_API FString GetEnginePath(
 	const FUnrealVersion& UnrealVersion,
 	EEngineType EngineType);
 
+// Starts updating the source engines of UnrealVersions in the background
+// GetEnginePath then only waits for the update of the version it returns
+FORGE_API void PrefetchSourceEngines(const TArray<FUnrealVersion>& UnrealVersions);
+
 FORGE_API FString GetRunUATPath(
 	const FUnrealVersion& UnrealVersion,
 	EEngineType EngineType);
@@ -174,10 +466,104 @@ FORGE_API FString RunUAT(
 	EEngineType EngineType,
 	const FString& Command);
 
+// Runs UAT for several versions and platforms concurrently
+// Each run gets its own environment, Linux toolchain and directory
+// Runs of the same engine are serialized, and skipped once one of them failed
+// Runs of different engines are limited by their Memory and the available physical memory
+class FORGE_API FRunUATMatrix
+{
+public:
+	struct FRun
+	{
+		FUnrealVersion UnrealVersion;
+		EEngineType EngineType = EEngineType::Launcher;
+		FString Platform;
+		// {Directory} is replaced by a directory private to this run, eg -Package={Directory}/Package
+		FString Command;
+		int64 Memory = 16ll * 1024 * 1024 * 1024;
+
+		FString Directory;
+		bool bSuccess = false;
+		double Duration = 0;
+		FString Output;
+		TArray<FString> Errors;
+	};
+
+	FRun& Add(
+		const FUnrealVersion& UnrealVersion,
+		EEngineType EngineType,
+		const FString& Platform,
+		const FString& Command);
+
+	const TArray<FRun>& GetRuns() const
+	{
+		return Runs;
+	}
+
+	bool TryRun();
+	void Run();
+
+private:
+	TArray<FRun> Runs;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+class IHttpRequest;
+
+struct FORGE_API FHttpResponse
+{
+	int32 Code = 0;
+	FString Content;
+	// Name: Value
+	TArray<FString> Headers;
+
+	FString GetHeader(const FString& Name) const;
+};
+
+// Request in flight, returned by Send
+// Waiting blocks on an event signaled from the HTTP thread instead of spinning
+class FORGE_API FHttpFuture
+{
+public:
+	struct FState;
+
+	FHttpFuture() = default;
+	explicit FHttpFuture(const TSharedRef<FState>& State)
+		: State(State)
+	{
+	}
+
+	bool IsValid() const
+	{
+		return State.IsValid();
+	}
+	bool IsReady() const;
+
+	void Wait() const;
+	// Returns false if the request is still in flight after Seconds
+	bool WaitFor(double Seconds) const;
+	// Waits, then fails like the blocking API if the request failed
+	const FHttpResponse& Get() const;
+	// Waits, then returns null if the request failed
+	const FHttpResponse* TryGet() const;
+
+private:
+	TSharedPtr<FState> State;
+};
+
+// Waits for all the requests and returns their responses in the same order
+FORGE_API TArray<FHttpResponse> Http_WhenAll(TConstArrayView<FHttpFuture> Futures);
+
+// Sends the requests with at most MaxConcurrency in flight and returns the responses in the same order
+// Each request is only built and sent once a slot frees up, eg [&] { return Http_Get(Url).Send(); }
+FORGE_API TArray<FHttpResponse> Http_Batch(
+	TConstArrayView<TFunction<FHttpFuture()>> Requests,
+	int32 MaxConcurrency = 16);
+
+// Sent when destroyed and waited on, unless Send was called
 class FORGE_API FHttpGet
 {
 public:
@@ -200,17 +586,66 @@ public:
 		return *this;
 	}
 
+	// Only requests bytes Start to End included
+	FHttpGet& Range(const int64 Start, const int64 End)
+	{
+		check(0 <= Start && Start <= End);
+		PrivateRangeStart = Start;
+		PrivateRangeEnd = End;
+		return *this;
+	}
+
+	// Streams the body to Path instead of keeping it in memory
+	// Interrupted downloads are retried, resuming from Path.part with a Range request
+	// Part files are only resumed across runs with an If-Range on the ETag or Last-Modified of the response that started them
+	// If set, the size and hex SHA-1 are checked before Path is written
+	FHttpGet& ToFile(
+		const FString& Path,
+		const FString& ExpectedSha1 = {},
+		const int64 ExpectedSize = -1)
+	{
+		PrivateFilePath = Path;
+		PrivateExpectedSha1 = ExpectedSha1;
+		PrivateExpectedSize = ExpectedSize;
+		return *this;
+	}
+
+	// Starts the request without waiting for it
+	// Not supported with ToFile, which retries and must be waited on
+	FHttpFuture Send();
+
 private:
 	const FString Url;
 	TMap<FString, FString> Headers;
 	TMap<FString, FString> QueryParameters;
+	FString PrivateFilePath;
+	FString PrivateExpectedSha1;
+	int64 PrivateExpectedSize = -1;
+	int64 PrivateRangeStart = -1;
+	int64 PrivateRangeEnd = -1;
+	bool bSent = false;
+
+	TSharedRef<IHttpRequest> CreateRequest() const;
+	void DownloadToFile();
 };
 FORGE_API FHttpGet Http_Get(const FString& Url);
 
+// Downloads Url to Path over NumSegments concurrent Range requests if the server accepts them, a single one otherwise
+// Segments are written at their offset in a preallocated Path.part, which is hashed once complete
+// Progress is saved to Path.part.segments, so that another run can resume the segments
+// Segments are requested with an If-Range on the ETag or Last-Modified returned by HEAD, so they all come from the same version of the file
+FORGE_API void Http_DownloadSegmented(
+	const FString& Url,
+	const FString& Path,
+	const FString& ExpectedSha1 = {},
+	int32 NumSegments = 8,
+	const TMap<FString, FString>& Headers = {});
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+// Sent when destroyed and waited on, unless Send was called
 class FORGE_API FHttpPost
 {
 public:
@@ -237,24 +672,37 @@ public:
 		PrivateContent = Value;
 		return *this;
 	}
+	// Streamed from memory without being copied, can be larger than 2GB
 	FHttpPost& Content(TArray64<uint8>&& Value)
 	{
 		PrivateContent_Bytes = MoveTemp(Value);
 		return *this;
 	}
+	// Streamed from disk while uploading, memory usage doesn't depend on the file size
+	FHttpPost& ContentFromFile(const FString& Path)
+	{
+		PrivateContent_Path = Path;
+		return *this;
+	}
+	// Called with the response content once the request is waited on
 	FHttpPost& OnComplete(TFunction<void(FString)> Value)
 	{
 		PrivateOnComplete = MoveTemp(Value);
 		return *this;
 	}
 
+	// Starts the request without waiting for it
+	FHttpFuture Send();
+
 private:
 	const FString Url;
 	TMap<FString, FString> Headers;
 	TMap<FString, FString> QueryParameters;
 	FString PrivateContent;
 	TArray64<uint8> PrivateContent_Bytes;
+	FString PrivateContent_Path;
 	TFunction<void(FString)> PrivateOnComplete;
+	bool bSent = false;
 };
 FORGE_API FHttpPost Http_Post(const FString& Url);
 